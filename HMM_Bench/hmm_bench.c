@@ -0,0 +1,460 @@
+/**************** Author  : Mohamed Ayman *****************/
+/**************** Name    : hmm_bench.c   *****************/
+/**************** Version : 0.0.1         *****************/
+/**************** Date    : 12-8-2024     *****************/
+
+// Reproducible allocation benchmarks. Build once per allocator and compare the reports:
+//   gcc -O2 -DHMM_NO_DEMO -DBENCH_LABEL='"fixed"'   -o bench_fixed   HMM_Bench/hmm_bench.c HMM_Fixed/hmm.c
+//   gcc -O2 -DHMM_NO_DEMO -DBENCH_LABEL='"reduced"' -o bench_reduced HMM_Bench/hmm_bench.c HMM_Reduced/hmm_reduced.c
+//   gcc -O2 -DBENCH_SYSTEM_MALLOC -DBENCH_LABEL='"malloc"' -o bench_malloc HMM_Bench/hmm_bench.c
+// Add -DHMM_THREAD_SAFE -pthread to all three to run the producer/consumer workload on two real threads.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#ifdef HMM_THREAD_SAFE
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
+#ifndef BENCH_LABEL
+#define BENCH_LABEL "hmm"
+#endif
+
+#define DEFAULT_SEED 42           // Every run uses the same operation sequence unless a seed is given
+#define MAX_SAMPLES (4 * 1024 * 1024)  // Latency samples kept per workload
+
+#ifdef BENCH_SYSTEM_MALLOC
+// Baseline: the same workloads against the C library allocator
+#define HmmAlloc malloc
+#define HmmFree free
+#define HmmRealloc realloc
+#else
+// Declare external functions for the custom Heap Memory Manager
+extern void *HmmAlloc(size_t size);                 // Function to allocate memory
+extern void HmmFree(void *ptr);                     // Function to free allocated memory
+extern void *HmmRealloc(void *ptr, size_t size);    // Function to resize allocated memory
+#endif
+
+// Latencies and memory high-water marks of one workload
+typedef struct Recorder
+{
+    uint32_t *samples;          // Nanoseconds taken by each timed operation
+    size_t count;               // Number of samples taken
+    size_t capacity;            // Number of samples that fit in samples
+    size_t live;                // Bytes currently allocated by the workload
+    size_t peak_live;           // Highest value of live
+} Recorder;
+
+// A workload runs a fixed sequence of operations derived from the seed
+typedef struct Workload
+{
+    const char *name;
+    void (*run)(Recorder *rec, uint64_t seed);
+} Workload;
+
+// Function prototypes
+uint64_t next_random(uint64_t *state);
+uint64_t now_ns(void);
+void record(Recorder *rec, uint64_t start);
+void track(Recorder *rec, long delta);
+void *timed_alloc(Recorder *rec, size_t size);
+void timed_free(Recorder *rec, void *ptr, size_t size);
+void run_small_churn(Recorder *rec, uint64_t seed);
+void run_producer_consumer(Recorder *rec, uint64_t seed);
+void run_large_growth(Recorder *rec, uint64_t seed);
+void run_fragmentation(Recorder *rec, uint64_t seed);
+void run_workload(const Workload *workload, uint64_t seed);
+long current_rss_kb(void);
+int compare_samples(const void *a, const void *b);
+
+static const Workload workloads[] =
+{
+    { "small-churn", run_small_churn },
+    { "producer-consumer", run_producer_consumer },
+    { "large-growth", run_large_growth },
+    { "fragmentation", run_fragmentation },
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+int main(int argc, char **argv)
+{
+    // Usage: bench [seed] [workload name]
+    uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 0) : DEFAULT_SEED;
+    const char *only = argc > 2 ? argv[2] : NULL;
+
+    printf("%-8s %-18s %10s %12s %8s %8s %8s %8s %10s %11s %11s %7s\n",
+           "alloc", "workload", "ops", "ops/sec", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns",
+           "peak KB", "live KB", "frag");
+    fflush(stdout);
+
+    for (size_t i = 0; i < NUM_WORKLOADS; i++)
+    {
+        if (only && strcmp(only, workloads[i].name) != 0)
+        {
+            continue;
+        }
+
+        // Each workload runs in its own process so its peak memory is not hidden by the previous one
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            run_workload(&workloads[i], seed);
+            exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
+
+// Function to run one workload in the current process and print its report line
+void run_workload(const Workload *workload, uint64_t seed)
+{
+    Recorder rec = { 0 };
+    rec.samples = malloc(MAX_SAMPLES * sizeof(uint32_t));
+    rec.capacity = MAX_SAMPLES;
+    if (rec.samples == NULL)
+    {
+        printf("%-8s %-18s out of memory for samples\n", BENCH_LABEL, workload->name);
+        return;
+    }
+    memset(rec.samples, 0xFF, MAX_SAMPLES * sizeof(uint32_t));  // Touch the buffer so it counts in the baseline; a zero fill could be folded into calloc
+
+    long baseline_kb = current_rss_kb();
+    uint64_t start = now_ns();
+    workload->run(&rec, seed);
+    uint64_t elapsed = now_ns() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peak_kb = usage.ru_maxrss - baseline_kb;  // Memory the allocator needed on top of the harness
+
+    qsort(rec.samples, rec.count, sizeof(uint32_t), compare_samples);
+    size_t n = rec.count ? rec.count : 1;
+    double peak_live_kb = rec.peak_live / 1024.0;
+
+    printf("%-8s %-18s %10zu %12.0f %8u %8u %8u %8u %10u %11ld %11.0f %7.2f\n",
+           BENCH_LABEL, workload->name, rec.count, rec.count / (elapsed / 1e9),
+           rec.samples[n * 50 / 100], rec.samples[n * 90 / 100], rec.samples[n * 99 / 100],
+           rec.samples[n * 999 / 1000], rec.samples[n - 1],
+           peak_kb, peak_live_kb, peak_live_kb > 0 ? peak_kb / peak_live_kb : 0.0);
+    fflush(stdout);
+}
+
+// Function to make the next number of a xorshift64* sequence
+uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Function to read a monotonic clock in nanoseconds
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Function to store the latency of an operation that started at the given time
+void record(Recorder *rec, uint64_t start)
+{
+    uint64_t ns = now_ns() - start;
+    if (rec->count < rec->capacity)
+    {
+        rec->samples[rec->count++] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+    }
+}
+
+// Function to keep the count of live bytes and its high-water mark
+void track(Recorder *rec, long delta)
+{
+    rec->live += delta;
+    if (rec->live > rec->peak_live)
+    {
+        rec->peak_live = rec->live;
+    }
+}
+
+// Function to allocate and time it, touching the memory like a real caller would
+void *timed_alloc(Recorder *rec, size_t size)
+{
+    uint64_t start = now_ns();
+    void *ptr = HmmAlloc(size);
+    record(rec, start);
+    if (ptr)
+    {
+        memset(ptr, 0xA5, size);
+        track(rec, (long)size);
+    }
+    return ptr;
+}
+
+// Function to free and time it
+void timed_free(Recorder *rec, void *ptr, size_t size)
+{
+    uint64_t start = now_ns();
+    HmmFree(ptr);
+    record(rec, start);
+    track(rec, -(long)size);
+}
+
+// Workload: random allocations and frees of 8 to 256 byte objects over a fixed set of slots
+void run_small_churn(Recorder *rec, uint64_t seed)
+{
+    enum { SLOTS = 20000, OPS = 2000000 };
+    static void *slots[SLOTS];
+    static size_t sizes[SLOTS];
+    uint64_t state = seed;
+
+    for (int i = 0; i < OPS; i++)
+    {
+        size_t slot = next_random(&state) % SLOTS;
+        if (slots[slot])
+        {
+            timed_free(rec, slots[slot], sizes[slot]);
+            slots[slot] = NULL;
+        }
+        else
+        {
+            // Most objects are tiny, like list nodes and strings
+            size_t size = next_random(&state) % 4 ? 8 + next_random(&state) % 57 : 65 + next_random(&state) % 192;
+            slots[slot] = timed_alloc(rec, size);
+            sizes[slot] = size;
+        }
+    }
+
+    for (int i = 0; i < SLOTS; i++)
+    {
+        if (slots[i])
+        {
+            timed_free(rec, slots[i], sizes[i]);
+        }
+    }
+}
+
+#ifdef HMM_THREAD_SAFE
+#define QUEUE_SIZE 1024
+
+// Single-producer single-consumer ring of buffers handed from one thread to the other
+typedef struct Queue
+{
+    void *items[QUEUE_SIZE];
+    size_t sizes[QUEUE_SIZE];
+    _Atomic size_t head;        // Next slot the producer fills
+    _Atomic size_t tail;        // Next slot the consumer empties
+    _Atomic size_t freed_bytes; // Bytes the consumer has freed so far
+    size_t total;               // Number of buffers to pass
+    uint64_t seed;
+    Recorder consumer;          // The consumer's own latencies, merged after the run
+} Queue;
+
+// Function run by the consumer thread: free every buffer the producer passes
+void *consumer_thread(void *arg)
+{
+    Queue *queue = arg;
+    for (size_t done = 0; done < queue->total; done++)
+    {
+        size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        while (atomic_load_explicit(&queue->head, memory_order_acquire) == tail)
+        {
+            // Wait for the producer
+        }
+        uint64_t start = now_ns();
+        HmmFree(queue->items[tail % QUEUE_SIZE]);
+        record(&queue->consumer, start);
+        atomic_fetch_add_explicit(&queue->freed_bytes, queue->sizes[tail % QUEUE_SIZE], memory_order_relaxed);
+        atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+#endif
+
+// Workload: buffers are allocated in one place and freed in another, in the order they were made
+void run_producer_consumer(Recorder *rec, uint64_t seed)
+{
+    enum { TOTAL = 1000000, IN_FLIGHT = 1024 };
+    uint64_t state = seed;
+
+#ifdef HMM_THREAD_SAFE
+    static Queue queue;
+    queue.total = TOTAL;
+    queue.consumer.samples = rec->samples + MAX_SAMPLES / 2;  // The consumer writes the second half
+    queue.consumer.capacity = MAX_SAMPLES / 2;
+    size_t allocated_bytes = 0;
+
+    pthread_t consumer;
+    pthread_create(&consumer, NULL, consumer_thread, &queue);
+
+    for (size_t i = 0; i < TOTAL; i++)
+    {
+        size_t size = 64 + next_random(&state) % 4033;  // Messages of 64 bytes to 4 KB
+        while (i - atomic_load_explicit(&queue.tail, memory_order_acquire) >= IN_FLIGHT)
+        {
+            // Wait for the consumer to catch up
+        }
+        uint64_t start = now_ns();
+        void *ptr = HmmAlloc(size);
+        if (rec->count < MAX_SAMPLES / 2)
+        {
+            record(rec, start);
+        }
+        if (ptr)
+        {
+            memset(ptr, 0x5A, size);
+        }
+        else
+        {
+            size = 0;  // The heap is full: the consumer frees NULL, and nothing counts as live
+        }
+        allocated_bytes += size;
+        rec->live = allocated_bytes - atomic_load_explicit(&queue.freed_bytes, memory_order_relaxed);
+        track(rec, 0);
+        queue.items[i % QUEUE_SIZE] = ptr;
+        queue.sizes[i % QUEUE_SIZE] = size;
+        atomic_store_explicit(&queue.head, i + 1, memory_order_release);
+    }
+    pthread_join(consumer, NULL);
+
+    // Put the consumer's samples right after the producer's
+    memmove(rec->samples + rec->count, queue.consumer.samples, queue.consumer.count * sizeof(uint32_t));
+    rec->count += queue.consumer.count;
+#else
+    // Without the thread-safe mode the two ends take turns on one thread through a FIFO
+    static void *fifo[IN_FLIGHT];
+    static size_t sizes[IN_FLIGHT];
+    for (size_t i = 0; i < TOTAL; i++)
+    {
+        size_t index = i % IN_FLIGHT;
+        if (fifo[index])
+        {
+            timed_free(rec, fifo[index], sizes[index]);  // The oldest buffer goes first
+        }
+        sizes[index] = 64 + next_random(&state) % 4033;  // Messages of 64 bytes to 4 KB
+        fifo[index] = timed_alloc(rec, sizes[index]);
+    }
+    for (size_t i = 0; i < IN_FLIGHT; i++)
+    {
+        timed_free(rec, fifo[i], sizes[i]);
+    }
+#endif
+}
+
+// Workload: buffers that grow by doubling through realloc, alongside short-lived small allocations
+void run_large_growth(Recorder *rec, uint64_t seed)
+{
+    enum { ROUNDS = 50, BUFFERS = 8, MAX_SIZE = 4 * 1024 * 1024 };
+    uint64_t state = seed;
+
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        void *buffers[BUFFERS] = { NULL };
+        size_t sizes[BUFFERS] = { 0 };
+        size_t limit = 64 * 1024 + next_random(&state) % MAX_SIZE;
+
+        for (size_t size = 64; size <= limit; size *= 2)
+        {
+            for (int b = 0; b < BUFFERS; b++)
+            {
+                uint64_t start = now_ns();
+                void *grown = HmmRealloc(buffers[b], size);
+                record(rec, start);
+                if (grown == NULL)
+                {
+                    continue;
+                }
+                memset((uint8_t *)grown + sizes[b], 0x3C, size - sizes[b]);  // Fill the new part like an append would
+                track(rec, (long)(size - sizes[b]));
+                buffers[b] = grown;
+                sizes[b] = size;
+
+                // A small temporary between appends pins the space after the buffer now and then
+                size_t temp_size = 16 + next_random(&state) % 512;
+                timed_free(rec, timed_alloc(rec, temp_size), temp_size);
+            }
+        }
+
+        for (int b = 0; b < BUFFERS; b++)
+        {
+            if (buffers[b])
+            {
+                timed_free(rec, buffers[b], sizes[b]);
+            }
+        }
+    }
+}
+
+// Workload: fill the heap with mixed sizes, free every other block, then ask for blocks the holes cannot hold
+void run_fragmentation(Recorder *rec, uint64_t seed)
+{
+    enum { BLOCKS = 50000, PHASES = 5 };
+    static void *blocks[BLOCKS];
+    static size_t sizes[BLOCKS];
+    uint64_t state = seed;
+
+    for (int phase = 0; phase < PHASES; phase++)
+    {
+        size_t max_size = 256 << phase;  // Every phase asks for bigger blocks than the last one left holes for
+        for (int i = phase & 1; i < BLOCKS; i += 2)
+        {
+            if (blocks[i])
+            {
+                timed_free(rec, blocks[i], sizes[i]);
+            }
+            sizes[i] = 16 + next_random(&state) % max_size;
+            blocks[i] = timed_alloc(rec, sizes[i]);
+        }
+        for (int i = !(phase & 1); i < BLOCKS; i += 4)
+        {
+            if (blocks[i])
+            {
+                timed_free(rec, blocks[i], sizes[i]);
+                blocks[i] = NULL;
+            }
+        }
+    }
+
+    for (int i = 0; i < BLOCKS; i++)
+    {
+        if (blocks[i])
+        {
+            timed_free(rec, blocks[i], sizes[i]);
+            blocks[i] = NULL;
+        }
+    }
+}
+
+// Function to read the resident set size of the process in KB
+long current_rss_kb(void)
+{
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm)
+    {
+        long size;
+        if (fscanf(statm, "%ld %ld", &size, &pages) != 2)
+        {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Function to order latency samples for the percentiles
+int compare_samples(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
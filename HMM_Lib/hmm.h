@@ -0,0 +1,4327 @@
+/**************** Author  : Mohamed Ayman *****************/
+/**************** Name    : hmm.h         *****************/
+/**************** Version : 0.0.1         *****************/
+/**************** Date    : 12-8-2024     *****************/
+
+// Heap Memory Manager as a single-header library.
+//
+// Include this header wherever the allocator is called, and in exactly one translation unit define
+// HMM_IMPLEMENTATION before including it, so that unit compiles the allocator itself:
+//
+//     #define HMM_IMPLEMENTATION
+//     #include "hmm.h"
+//
+// Include it first there: HMM_USE_MMAP needs _GNU_SOURCE for mremap(), which must come before any system header.
+// The implementation is one translation unit, so every call made inside it, and every call elsewhere under -flto,
+// can be inlined down to the strategy that was compiled in.
+//
+// Everything is configured at compile time, and every unit must be built with the same macros:
+//     HMM_REDUCED         Reduced strategy: the break grows in doubling chunks and shrinks back when the top is free;
+//                         without it, the Fixed strategy grows the heap by exactly what each request needs
+//     HMM_HEAP_SIZE       Size of the static heap, or of the address space HMM_USE_MMAP reserves
+//     HMM_CHUNK_SIZE      Smallest and largest step of the program break of HMM_REDUCED (16 KB and 4 MB by default)
+//     HMM_CHUNK_MAX
+//     HMM_ALIGNMENT       Alignment of every payload, a power of two no smaller than the word size (the default)
+//     HMM_BEST_FIT        Placement of large blocks: a red-black tree for best fit, or a TLSF two-level index,
+//     HMM_TLSF            instead of the default segregated power-of-two bins
+// The features are HMM_THREAD_SAFE, HMM_COMPACT_HEADER, HMM_USE_MMAP, HMM_NUMA, HMM_HUGEPAGES, HMM_CACHE_ALIGNED,
+// HMM_LAZY_COALESCE, HMM_PERSISTENT, HMM_HARDENED, HMM_STATS, HMM_PROFILE and HMM_TRACE, described in the README.
+
+#if defined(HMM_IMPLEMENTATION) && defined(HMM_USE_MMAP) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // For mremap(), before the first system header
+#endif
+
+#ifndef HMM_H
+#define HMM_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifndef HMM_ALIGNMENT
+#define HMM_ALIGNMENT __SIZEOF_SIZE_T__  // Alignment of every payload, the system's word size by default
+#endif
+#if HMM_ALIGNMENT < __SIZEOF_SIZE_T__ || (HMM_ALIGNMENT & (HMM_ALIGNMENT - 1))
+#error "HMM_ALIGNMENT must be a power of two no smaller than the word size"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// State of one heap, made by HmmArenaCreate()
+typedef struct HmmArena HmmArena;
+
+void *HmmAlloc(size_t size);
+void HmmFree(void *ptr);
+void HmmFreeSized(void *ptr, size_t size);
+void *HmmRealloc(void *ptr, size_t size);
+void *HmmCalloc(size_t count, size_t size);
+size_t HmmAllocBatch(size_t size, size_t count, void **out);
+void HmmFreeBatch(void **ptrs, size_t count);
+void *HmmAllocAligned(size_t size, size_t alignment);
+size_t HmmUsableSize(void *ptr);
+HmmArena *HmmArenaCreate(void *buffer, size_t size);
+void *HmmArenaAlloc(HmmArena *arena, size_t size);
+void *HmmArenaAllocAligned(HmmArena *arena, size_t size, size_t alignment);
+void HmmArenaFree(HmmArena *arena, void *ptr);
+void *HmmArenaRealloc(HmmArena *arena, void *ptr, size_t size);
+void *HmmRegionAlloc(HmmArena *arena, size_t size);
+void HmmRegionReset(HmmArena *arena);
+#ifdef HMM_PERSISTENT
+HmmArena *HmmArenaOpen(const char *path, size_t size);
+int HmmArenaSync(HmmArena *arena);
+void HmmArenaClose(HmmArena *arena);
+void HmmArenaSetRoot(HmmArena *arena, void *ptr);
+void *HmmArenaRoot(HmmArena *arena);
+#endif
+#ifdef HMM_LAZY_COALESCE
+void HmmCoalesce(void);
+#ifdef HMM_THREAD_SAFE
+int HmmStartCoalescer(void);
+#endif
+#endif
+
+#ifdef HMM_STATS
+// Event counters kept by HMM_STATS builds, one X() per counter
+#define HMM_STAT_COUNTERS(X) \
+    X(alloc_calls) X(free_calls) X(realloc_calls) X(realloc_in_place) X(calloc_calls) X(failed_allocs) \
+    X(bytes_allocated) X(bytes_freed) X(splits) X(merges) X(heap_extensions) X(heap_trims) \
+    X(searches) X(search_steps) X(slab_allocs) X(slab_frees) X(tcache_hits) X(tcache_refills) \
+    X(remote_frees) X(deferred_frees) X(mapped_allocs) X(mapped_frees) X(node_remote_frees) \
+    X(coalesce_passes) X(aligned_allocs)
+
+#define STAT_FIELD(name) size_t name;
+
+// Snapshot filled in by HmmStats(): the counters summed over all threads, then gauges read at the time of the call
+typedef struct HmmStatistics
+{
+    HMM_STAT_COUNTERS(STAT_FIELD)
+    size_t in_use_bytes;        // Bytes in blocks, slab objects and mappings handed out, thread-cached ones included
+    size_t heap_used;           // How far the program break has advanced
+    size_t heap_peak;           // Furthest the program break has ever been
+    size_t heap_size;           // Most the program break can advance (HEAP_SIZE)
+    size_t free_blocks;         // Blocks in the free lists
+    size_t free_bytes;          // Payload bytes in the free lists
+    size_t largest_free_block;  // Largest payload in the free lists
+    size_t slabs;               // Slabs carved from the slab area
+    size_t empty_slabs;         // Slabs in the empty pool
+    size_t pending_bytes;       // Bytes freed but not merged into the free lists yet (HMM_LAZY_COALESCE)
+} HmmStatistics;
+void HmmStats(HmmStatistics *stats);
+void HmmDumpHeap(FILE *out);
+#endif
+
+#ifdef HMM_PROFILE
+int HmmProfileWrite(FILE *out);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#if defined(HMM_IMPLEMENTATION) && !defined(HMM_IMPLEMENTED)
+#define HMM_IMPLEMENTED  // A second include in the same unit must not compile the allocator twice
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(HMM_USE_MMAP) || defined(HMM_HUGEPAGES) || defined(HMM_REDUCED)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef HMM_THREAD_SAFE
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
+#ifdef HMM_NUMA
+#include <sys/syscall.h>
+#endif
+
+#ifdef HMM_PERSISTENT
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef HMM_HUGEPAGES
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)        // Size of a transparent huge page on x86-64 and most arm64 kernels
+#define HEAP_PAGE_SIZE ((size_t)HUGE_PAGE_SIZE)  // Trims and releases cover whole huge pages, so the rest of the heap stays huge
+#else
+#define HEAP_PAGE_SIZE ((size_t)sysconf(_SC_PAGESIZE))
+#endif
+
+#if defined(HMM_NUMA) && !defined(HMM_USE_MMAP)
+#error "HMM_NUMA needs HMM_USE_MMAP: each node's arena is a part of the heap reservation"
+#endif
+
+#if defined(HMM_CACHE_ALIGNED) && defined(HMM_NUMA)
+#error "HMM_CACHE_ALIGNED aligns small objects through the slabs, which HMM_NUMA does not use"
+#endif
+
+#if defined(HMM_PERSISTENT) && defined(HMM_BEST_FIT)
+#error "HMM_PERSISTENT makes the free lists position-independent, the tree of HMM_BEST_FIT still links through pointers"
+#endif
+
+#ifdef HMM_USE_MMAP
+#ifndef HMM_HEAP_SIZE
+#define HMM_HEAP_SIZE ((size_t)1 << (sizeof(void *) == 8 ? 36 : 30))  // Address space reserved for the heap (64 GB, 1 GB on 32-bit)
+#endif
+#define HEAP_SIZE ((size_t)(HMM_HEAP_SIZE))
+#ifdef HMM_HUGEPAGES
+#define HEAP_COMMIT_CHUNK HUGE_PAGE_SIZE    // The reservation is made writable one huge page at a time
+#else
+#define HEAP_COMMIT_CHUNK (1024 * 1024)     // The reservation is made writable in 1 MB steps as the break grows
+#endif
+#ifndef HMM_REDUCED
+#define HEAP_TRIM_THRESHOLD (1024 * 1024)   // A free block this large at the top of the heap moves the break back
+#endif
+#define HEAP_RELEASE_THRESHOLD (1024 * 1024) // A free block this large inside the heap gives its pages back to the OS
+#define MMAP_THRESHOLD (256 * 1024)         // Requests this large get pages of their own instead of a heap block
+
+#ifdef HMM_NUMA
+#ifndef HMM_MAX_NODES
+#define HMM_MAX_NODES 8  // Nodes the reservation is split between; a thread on a higher node uses node % HMM_MAX_NODES
+#endif
+#if HMM_MAX_NODES & (HMM_MAX_NODES - 1)
+#error "HMM_MAX_NODES must be a power of two so every node's part of the heap starts on a page"
+#endif
+#define NODE_HEAP_SIZE (HEAP_SIZE / HMM_MAX_NODES)  // Part of the reservation each node's arena gets
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1  // From <linux/mempolicy.h>: place pages on the given node while it has free memory
+#endif
+#endif
+
+// Whether an address lies in the heap reservation; anything else outside the slabs and arenas is a directly mapped block
+#define IS_HEAP_POINTER(ptr) (main_arena.heap != NULL && (uintptr_t)(ptr) - (uintptr_t)main_arena.heap < HEAP_SIZE)
+#define IS_MAPPED_POINTER(ptr) (!IS_HEAP_POINTER(ptr) && !IS_SLAB_POINTER(ptr))
+
+// Size of a page, read when the heap is reserved
+static size_t page_size;
+#else
+#ifndef HMM_HEAP_SIZE
+#define HMM_HEAP_SIZE (200 * 1024 * 1024)  // Size of the simulated heap (200MB), can be tuned with -DHMM_HEAP_SIZE
+#endif
+#define HEAP_SIZE HMM_HEAP_SIZE
+
+// Statically allocated array simulating the heap area
+#ifdef HMM_HUGEPAGES
+static _Alignas(HUGE_PAGE_SIZE) uint8_t heap[HEAP_SIZE];  // Aligned so the kernel can back it with huge pages
+#else
+static _Alignas(HMM_ALIGNMENT) uint8_t heap[HEAP_SIZE];
+#endif
+
+// Whether an address lies in heap[], rather than in a slab
+#define IS_HEAP_POINTER(ptr) ((uint8_t *)(ptr) >= heap && (uint8_t *)(ptr) < heap + HEAP_SIZE)
+
+#ifdef HMM_REDUCED
+// Size of a page, read when the heap is first trimmed
+static size_t page_size;
+#endif
+#endif
+
+#ifdef HMM_PERSISTENT
+// Free-list links hold the distance from the block they sit in to the block they point at, 0 for none,
+// so a heap file mapped at another address is still linked correctly
+typedef intptr_t BlockLink;
+#define LINK_TO(from, to) ((to) ? (BlockLink)((uintptr_t)(to) - (uintptr_t)(from)) : 0)
+#define LINK_FROM(from, link) ((link) ? (BlockHeader *)((uintptr_t)(from) + (link)) : NULL)
+#else
+typedef struct BlockHeader *BlockLink;  // Free-list links are plain pointers
+#define LINK_TO(from, to) (to)
+#define LINK_FROM(from, link) (link)
+#endif
+
+
+#ifdef HMM_COMPACT_HEADER
+// Compact header: ALIGN() keeps the low bits of every size clear, so the two flags live there
+typedef struct BlockHeader
+{
+    _Alignas(HMM_ALIGNMENT) size_t size_flags;          // Size of the block (excluding the header) | BLOCK_ALLOCATED | PREV_ALLOCATED
+#ifdef HMM_HARDENED
+    uintptr_t check;                                    // GUARD_SEAL() while the block is handed out, with GUARD_FREED mixed in once it is freed
+#endif
+} BlockHeader;
+
+// Free-list links, only needed while a block is free, so they live at the start of its payload
+typedef struct FreeLinks
+{
+    BlockLink next;             // Link to the next block in the free list
+    BlockLink prev;             // Link to the previous block in the free list
+} FreeLinks;
+
+#define BLOCK_ALLOCATED ((size_t)1)  // Flag: the block is allocated
+#define PREV_ALLOCATED ((size_t)2)   // Flag: the block just before it in memory is allocated
+#define FLAG_MASK (BLOCK_ALLOCATED | PREV_ALLOCATED)
+
+#define BLOCK_SIZE(block) ((block)->size_flags & ~FLAG_MASK)
+#define SET_BLOCK_SIZE(block, s) ((block)->size_flags = (s) | ((block)->size_flags & FLAG_MASK))
+#define IS_FREE(block) (!((block)->size_flags & BLOCK_ALLOCATED))
+#define SET_FREE(block, f) ((block)->size_flags = (f) ? (block)->size_flags & ~BLOCK_ALLOCATED : (block)->size_flags | BLOCK_ALLOCATED)
+#define IS_PREV_FREE(block) (!((block)->size_flags & PREV_ALLOCATED))
+#define SET_PREV_FREE(block, f) ((block)->size_flags = (f) ? (block)->size_flags & ~PREV_ALLOCATED : (block)->size_flags | PREV_ALLOCATED)
+#define INIT_HEADER(block, s, f, pf) ((block)->size_flags = (s) | ((f) ? 0 : BLOCK_ALLOCATED) | ((pf) ? 0 : PREV_ALLOCATED))
+#define FREE_NEXT(block) LINK_FROM(block, ((FreeLinks *)((block) + 1))->next)
+#define FREE_PREV(block) LINK_FROM(block, ((FreeLinks *)((block) + 1))->prev)
+#define SET_FREE_NEXT(block, to) (((FreeLinks *)((block) + 1))->next = LINK_TO(block, to))
+#define SET_FREE_PREV(block, to) (((FreeLinks *)((block) + 1))->prev = LINK_TO(block, to))
+#define MIN_PAYLOAD ALIGN(sizeof(FreeLinks) + sizeof(size_t))  // A free block must hold its links and its footer
+#else
+// Structure representing a block of memory in the heap
+typedef struct BlockHeader 
+{
+
+    _Alignas(HMM_ALIGNMENT) size_t size;  // Size of the allocated block (excluding the header)
+    BlockLink next;             // Link to the next block in the free list
+    BlockLink prev;             // Link to the previous block in the free list
+    int free;                   // Flag indicating whether the block is free (1) or allocated (0)
+    int prev_free;              // Flag indicating whether the block just before this one in memory is free (1) or allocated (0)
+#ifdef HMM_HARDENED
+    uintptr_t check;            // GUARD_SEAL() while the block is handed out, with GUARD_FREED mixed in once it is freed
+#endif
+} BlockHeader;
+
+#define BLOCK_SIZE(block) ((block)->size)
+#define SET_BLOCK_SIZE(block, s) ((block)->size = (s))
+#define IS_FREE(block) ((block)->free)
+#define SET_FREE(block, f) ((block)->free = (f))
+#define IS_PREV_FREE(block) ((block)->prev_free)
+#define SET_PREV_FREE(block, f) ((block)->prev_free = (f))
+#define INIT_HEADER(block, s, f, pf) ((block)->size = (s), (block)->free = (f), (block)->prev_free = (pf), (block)->next = (block)->prev = 0)
+#define FREE_NEXT(block) LINK_FROM(block, (block)->next)
+#define FREE_PREV(block) LINK_FROM(block, (block)->prev)
+#define SET_FREE_NEXT(block, to) ((block)->next = LINK_TO(block, to))
+#define SET_FREE_PREV(block, to) ((block)->prev = LINK_TO(block, to))
+#define MIN_PAYLOAD ALIGN(sizeof(size_t))  // A free block must hold its footer
+#endif
+
+#define HEADER_SIZE sizeof(BlockHeader)  // Size of the block header
+#define ALIGN(x) (((x) + HMM_ALIGNMENT - 1) & ~(size_t)(HMM_ALIGNMENT - 1))  // Align to HMM_ALIGNMENT
+#define CACHE_LINE_SIZE 64  // Size of a cache line on x86-64 and most arm64 cores
+#define CACHE_ALIGN(x) (((x) + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1))  // Round up to whole cache lines
+#ifdef HMM_REDUCED
+#ifndef HMM_CHUNK_SIZE
+#define HMM_CHUNK_SIZE (1024 * 16)  // Smallest step the program break moves by (16KB), can be tuned with -DHMM_CHUNK_SIZE
+#endif
+#ifndef HMM_CHUNK_MAX
+#define HMM_CHUNK_MAX (4 * 1024 * 1024)  // Largest step the program break moves by (4MB), can be tuned with -DHMM_CHUNK_MAX
+#endif
+#if HMM_CHUNK_SIZE % HMM_ALIGNMENT
+#error "HMM_CHUNK_SIZE must be a multiple of HMM_ALIGNMENT"
+#endif
+#define CHUNK_WASTE_DIVISOR 8  // A step never exceeds 1/8 of the heap in use, which bounds the free space left at the top
+#define HEAP_TRIM_THRESHOLD (1024 * 1024)  // Free space this large past one step at the top of the heap moves the break back
+#endif
+#define NEXT_PHYSICAL(block) ((BlockHeader *)((uintptr_t)(block) + HEADER_SIZE + BLOCK_SIZE(block)))  // Block right after this one in memory
+#define PREV_PHYSICAL(block) ((BlockHeader *)((uintptr_t)(block) - ((size_t *)(block))[-1] - HEADER_SIZE))  // Block right before this one, found through its footer
+#define FOOTER(block) (((size_t *)NEXT_PHYSICAL(block))[-1])  // Boundary tag: last word of a free block holds its size
+#define FLOOR_LOG2(x) (sizeof(size_t) * 8 - 1 - (size_t)__builtin_clzl(x))  // Index of the highest set bit
+#define ZERO_STREAM_THRESHOLD (256 * 1024)  // HmmCalloc clears ranges this large with non-temporal stores
+
+// Size classes: exact-size bins for small blocks, then one bin per power of two
+#define NUM_SMALL_BINS 32                                // One bin for each aligned size up to SMALL_BIN_MAX
+#define SMALL_BIN_MAX (NUM_SMALL_BINS * sizeof(size_t))  // Largest size served by an exact-size bin (256 bytes on 64-bit)
+#ifdef HMM_TLSF
+#if defined(HMM_BEST_FIT)
+#error "HMM_TLSF and HMM_BEST_FIT are alternative placement policies"
+#endif
+// Two-level segregated fit: every power of two above SMALL_BIN_MAX is split into TLSF_SL_COUNT bins of equal width
+#define TLSF_SL_LOG2 4                                                  // Bits below the leading one that pick the second-level bin
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)                               // Second-level bins per power of two
+#define NUM_BINS (NUM_SMALL_BINS + sizeof(size_t) * 8 * TLSF_SL_COUNT)  // Total number of bins, one bit each in bin_bitmap
+#define BITMAP_WORDS ((NUM_BINS + 63) / 64)                             // Words of bin_bitmap, one bit each in bin_summary
+#else
+#define NUM_BINS 64                                      // Total number of bins, one bit each in bin_bitmap
+#endif
+
+#ifdef HMM_BEST_FIT
+// Links of a free block in the size-ordered tree, kept in its payload after any free-list links
+typedef struct TreeLinks
+{
+    struct BlockHeader *child[2];  // Subtrees of the blocks ordered before (0) and after (1) this one
+    struct BlockHeader *parent;    // Parent node, NULL at the root
+    size_t red;                    // Colour of the node: 1 red, 0 black
+} TreeLinks;
+
+#define TREE(block) ((TreeLinks *)((uintptr_t)((block) + 1) + MIN_PAYLOAD - sizeof(size_t)))  // Tree links of a large free block
+#define IS_RED(block) ((block) != NULL && TREE(block)->red)  // Missing children count as black
+#define TREE_BEFORE(a, b) (BLOCK_SIZE(a) < BLOCK_SIZE(b) || (BLOCK_SIZE(a) == BLOCK_SIZE(b) && (a) < (b)))  // Tree order: by size, then by address
+#define FREE_LINKS_SIZE (MIN_PAYLOAD + sizeof(TreeLinks))  // Start of a free block's payload that must survive release_pages()
+
+#else
+#define FREE_LINKS_SIZE MIN_PAYLOAD  // Start of a free block's payload that must survive release_pages()
+#endif
+
+#ifdef HMM_LAZY_COALESCE
+#ifndef LAZY_COALESCE_THRESHOLD
+#define LAZY_COALESCE_THRESHOLD (256 * 1024)  // Bytes of unmerged frees at which a free merges them all
+#endif
+#ifndef COALESCE_INTERVAL_MS
+#define COALESCE_INTERVAL_MS 10               // Period of the background coalescing thread
+#endif
+#endif
+
+// State of one heap: its memory, its program break and its free lists
+struct HmmArena
+{
+    uint8_t *heap;                        // Start of the arena's memory
+    size_t size;                          // Most the program break can advance past heap
+    void *program_break;                  // End of the part of the arena in use
+    void *zero_mark;                      // Memory at or above it is known to be zero
+#ifdef HMM_USE_MMAP
+    void *committed;                      // End of the part of an OS-backed arena's reservation that is readable and writable
+#endif
+    BlockHeader *last_block;              // Block that ends at the program break, NULL while the arena is empty
+    BlockHeader *free_lists[NUM_BINS];    // Segregated free lists, one per size class
+#ifdef HMM_TLSF
+    uint64_t bin_bitmap[BITMAP_WORDS];    // Bit i is set when free_lists[i] is non-empty
+    uint64_t bin_summary;                 // Bit w is set when bin_bitmap[w] is non-zero, so the first non-empty bin takes two bit scans
+#else
+    uint64_t bin_bitmap;                  // Bit i is set when free_lists[i] is non-empty
+#endif
+#ifdef HMM_BEST_FIT
+    BlockHeader *free_tree;               // Red-black tree of the free blocks larger than SMALL_BIN_MAX, replacing the power-of-two bins
+#endif
+#ifdef HMM_REDUCED
+    size_t growth_step;                   // Current step of the program break: doubles on every extension, halves on a trim
+#endif
+#ifdef HMM_LAZY_COALESCE
+    BlockHeader *pending;                 // Freed blocks not merged yet; they stay marked allocated and are linked through FREE_NEXT
+    size_t pending_bytes;                 // Payload bytes in pending
+#endif
+#ifdef HMM_PERSISTENT
+    uint64_t magic;                       // PERSISTENT_MAGIC in an arena kept in a file by HmmArenaOpen()
+    uint64_t layout;                      // PERSISTENT_LAYOUT of the build that made the file, which must match to reopen it
+    void *base;                           // Address the file is mapped at, the arena's own address once it is open
+    size_t file_size;                     // Size of the file and of its mapping
+    size_t root;                          // Offset from the arena of the object HmmArenaRoot() returns, 0 for none
+    int fd;                               // File behind the mapping, locked against other processes while it is open
+#endif
+    int os_backed;                        // Whether the OS commits the arena's pages and may take them back, only for the main arena
+#ifdef HMM_STATS
+    void *peak;                           // Furthest the program break has ever been
+#endif
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_t lock;                 // Lock of a created arena; the main arena shares heap_lock with the slabs
+#endif
+};
+
+#ifdef HMM_PERSISTENT
+#define PERSISTENT_MAGIC 0x31504145484d4d48ULL  // "HMMHEAP1"
+// Everything the layout of a heap file depends on: the arena, the block header, the alignment and the bins
+#define PERSISTENT_LAYOUT ((uint64_t)sizeof(HmmArena) | (uint64_t)HEADER_SIZE << 16 | (uint64_t)HMM_ALIGNMENT << 32 | (uint64_t)NUM_BINS << 48)
+#define REBASE(ptr, delta) ((ptr) ? (void *)((uintptr_t)(ptr) + (delta)) : NULL)  // Move a pointer into an arena mapped elsewhere
+#endif
+
+#ifdef HMM_NUMA
+// Heaps behind HmmAlloc(), one per NUMA node in consecutive parts of the reservation, set up by reserve_heap()
+static HmmArena node_arenas[HMM_MAX_NODES];
+#define main_arena node_arenas[0]  // Node 0's part starts the reservation, so IS_HEAP_POINTER() covers every node
+
+// NUMA node of the calling thread, read on its first call; threads are expected to stay on their node
+static _Thread_local int thread_node = -1;
+
+#define LOCAL_ARENA() (&node_arenas[current_node()])  // Arena new blocks of the calling thread come from
+#define ARENA_OF(ptr) (&node_arenas[((uintptr_t)(ptr) - (uintptr_t)main_arena.heap) / NODE_HEAP_SIZE])  // Arena a heap block belongs to
+#else
+// Heap behind HmmAlloc()
+#ifdef HMM_USE_MMAP
+#ifndef HMM_REDUCED
+static HmmArena main_arena = { .os_backed = 1 };  // Its memory is reserved on first use
+#else
+static HmmArena main_arena = { .os_backed = 1, .growth_step = HMM_CHUNK_SIZE };  // Its memory is reserved on first use
+#endif
+#else
+#ifndef HMM_REDUCED
+static HmmArena main_arena = { .heap = heap, .size = HEAP_SIZE, .program_break = heap, .zero_mark = heap, .os_backed = 1 };
+#else
+static HmmArena main_arena = { .heap = heap, .size = HEAP_SIZE, .program_break = heap, .zero_mark = heap, .os_backed = 1, .growth_step = HMM_CHUNK_SIZE };
+#endif
+#endif
+
+#define LOCAL_ARENA() (&main_arena)   // Arena new blocks of the calling thread come from
+#define ARENA_OF(ptr) (&main_arena)   // Arena a heap block belongs to
+#endif
+
+// Slab sub-allocator: small objects are carved from page-sized slabs with no per-object header
+#define SLAB_SIZE 4096                                        // Size and alignment of one slab
+#ifdef HMM_CACHE_ALIGNED
+#define SLAB_MAX_OBJECT SMALL_BIN_MAX                         // Every small size is rounded up to whole cache lines and served from a slab
+#else
+#define SLAB_MAX_OBJECT 64                                    // Largest request served from a slab
+#endif
+#define SLAB_CLASSES (SLAB_MAX_OBJECT / sizeof(size_t))        // One slab class per aligned size
+#define SLAB_AREA_SIZE 16 * 1024 * 1024                       // Address range reserved for slabs (16 MB)
+#define SLAB_BITMAP_WORDS (SLAB_SIZE / sizeof(size_t) / 64)   // Enough bits for a slab of the smallest objects
+#define SLAB_FROM_POINTER(ptr) ((Slab *)((uintptr_t)(ptr) & ~(uintptr_t)(SLAB_SIZE - 1)))  // A slab starts at the page holding the object
+#define IS_SLAB_POINTER(ptr) ((uint8_t *)(ptr) >= slab_area && (uint8_t *)(ptr) < slab_area + SLAB_AREA_SIZE)  // Whether an object lives in a slab
+
+// Structure at the start of every slab
+typedef struct Slab
+{
+    struct Slab *next;                   // Next slab in the partial list of its class, or in the empty pool
+    struct Slab *prev;                   // Previous slab in the partial list of its class
+    size_t object_size;                  // Size of every object in the slab
+    uint32_t capacity;                   // Number of objects the slab holds
+    uint32_t used;                       // Number of objects currently allocated
+    uint64_t bitmap[SLAB_BITMAP_WORDS];  // Bit i is set while object i is free
+} Slab;
+
+#ifdef HMM_CACHE_ALIGNED
+#define SLAB_HEADER_SIZE ALIGN(CACHE_ALIGN(sizeof(Slab)))  // Objects start on the first cache line after the slab header
+#else
+#define SLAB_HEADER_SIZE ALIGN(sizeof(Slab))  // Objects start right after the slab header
+#endif
+
+// Page-aligned area the slabs come from, kept apart from heap[] so an address tells which allocator owns it
+#ifdef HMM_HUGEPAGES
+static _Alignas(HUGE_PAGE_SIZE) uint8_t slab_area[SLAB_AREA_SIZE];  // Slabs of every class are carved side by side, so hot small objects share huge pages
+#else
+static _Alignas(SLAB_SIZE) uint8_t slab_area[SLAB_AREA_SIZE];
+#endif
+
+// Next never-used slab in slab_area; with HMM_NUMA no slab is carved, only the statistics and the hardened checks read it
+static uint8_t *slab_break __attribute__((unused)) = slab_area;
+
+// Slabs of each class that have at least one free object
+static Slab *slab_partial[SLAB_CLASSES];
+
+// Completely free slabs, ready to be reused by any class
+static Slab *slab_empty = NULL;
+
+#ifdef HMM_THREAD_SAFE
+#define TCACHE_MAX_SIZE SMALL_BIN_MAX  // Largest block size served from the per-thread caches
+#define TCACHE_LIMIT 64                // Blocks a thread may keep per size class before draining
+#define TCACHE_BATCH 32                // Blocks moved between a cache and the shared heap at a time
+#define NEXT_CACHED(ptr) (*(void **)(ptr))  // Cached objects are linked through the first word of their payload
+#ifdef HMM_CACHE_ALIGNED
+#define IS_CACHEABLE(ptr) IS_SLAB_POINTER(ptr)  // A heap block need not start on a cache line, so only slab objects are cached
+#else
+#define IS_CACHEABLE(ptr) 1
+#endif
+
+// Per-thread cache of small objects; cached objects stay allocated as far as the shared heap is concerned
+typedef struct ThreadCache
+{
+    void *bins[NUM_SMALL_BINS];          // Cached objects of each exact size, slab objects and blocks alike
+    unsigned int count[NUM_SMALL_BINS];  // Number of objects in each bin
+    int registered;                      // Flag indicating whether the thread-exit flush is installed
+} ThreadCache;
+
+// Lock guarding free_lists, bin_bitmap, last_block, program_break and the slabs
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef HMM_NUMA
+// Lock-free stacks of small objects freed into a full cache bin, one per node and size class, so a thread only adopts objects of its own node
+static _Atomic(void *) remote_frees[HMM_MAX_NODES][NUM_SMALL_BINS];
+#define REMOTE_FREES(index) (remote_frees[current_node()][index])
+#else
+// Lock-free stacks of small objects freed into a full cache bin, one per size class, drained by whichever thread next refills that class
+static _Atomic(void *) remote_frees[NUM_SMALL_BINS];
+#define REMOTE_FREES(index) (remote_frees[index])
+#endif
+
+// Lock-free stack of large blocks whose free found heap_lock busy, applied by the thread releasing the lock
+static _Atomic(void *) deferred_frees;
+
+// Cache of the calling thread
+static _Thread_local ThreadCache tcache;
+
+// Key whose destructor hands a thread's cached objects back to the shared heap when it exits
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+#endif
+
+#ifdef HMM_STATS
+#ifdef HMM_THREAD_SAFE
+#define STAT_ATOMIC_FIELD(name) _Atomic size_t name;
+
+// Counters of one thread; only the owner writes them, so relaxed loads and stores are enough
+typedef struct ThreadStats
+{
+    HMM_STAT_COUNTERS(STAT_ATOMIC_FIELD)
+    struct ThreadStats *next;   // Next thread in stats_threads
+    int registered;             // Flag indicating whether the thread is in stats_threads
+} ThreadStats;
+
+#define STAT_ADD(name, n) do { ThreadStats *stats_ = get_thread_stats(); atomic_store_explicit(&stats_->name, atomic_load_explicit(&stats_->name, memory_order_relaxed) + (n), memory_order_relaxed); } while (0)
+
+// Counters of the calling thread
+static _Thread_local ThreadStats thread_stats;
+
+// Threads with counters, and the summed counters of threads that have exited, both guarded by stats_lock
+static ThreadStats *stats_threads = NULL;
+static HmmStatistics stats_retired;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Key whose destructor folds a thread's counters into stats_retired when it exits
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+#else
+typedef struct ThreadStats
+{
+    HMM_STAT_COUNTERS(STAT_FIELD)
+} ThreadStats;
+
+#define STAT_ADD(name, n) (thread_stats.name += (n))
+
+// Counters of the only thread
+static ThreadStats thread_stats;
+#endif
+#else
+#define STAT_ADD(name, n) ((void)0)  // Counters are compiled out
+#endif
+
+#ifdef HMM_HARDENED
+#include <sys/auxv.h>
+
+#ifndef HMM_QUARANTINE_SLOTS
+#define HMM_QUARANTINE_SLOTS 256            // Freed objects a thread holds back before they can be reused
+#endif
+#ifndef HMM_QUARANTINE_BYTES
+#define HMM_QUARANTINE_BYTES (1024 * 1024)  // Bytes a thread holds back before the oldest object is really freed
+#endif
+#define GUARD_SIZE sizeof(uintptr_t)                         // Tail canary word added to every request
+#define GUARD_MIX ((uintptr_t)0x9e3779b97f4a7c15ULL)         // Odd multiplier spreading an address over the whole word
+#define GUARD_FREED ((uintptr_t)0xdeadf7eedeadf7eeULL)       // Mixed into the seal and the canary of a freed object
+#define GUARD_SEAL(block) ((((uintptr_t)(block) ^ BLOCK_SIZE(block)) * GUARD_MIX) ^ guard_key())  // Header check of a handed-out block
+#define GUARD_TAIL(ptr) (((uintptr_t)(ptr) * GUARD_MIX) ^ ~guard_key())                           // Canary of the object at ptr
+#define GUARD_WORD(ptr, usable) (*(uintptr_t *)((uintptr_t)(ptr) + (usable) - GUARD_SIZE))          // Last word of an object, where its canary sits
+
+// Freed objects not given back to the heap yet, oldest first, so a stale pointer does not reach a reused block right away
+typedef struct Quarantine
+{
+    void *ptrs[HMM_QUARANTINE_SLOTS];   // Ring of quarantined objects
+    size_t sizes[HMM_QUARANTINE_SLOTS]; // Size each was freed with through HmmFreeSized(), canary included, 0 for HmmFree()
+    size_t head;                        // Slot of the oldest object
+    size_t count;                       // Objects in the ring
+    size_t bytes;                       // Usable bytes of the objects in the ring
+    int registered;                     // Flag indicating whether the thread-exit flush is installed
+} Quarantine;
+
+// Random key of the seals and canaries, taken from the bytes the kernel hands every process (AT_RANDOM)
+static uintptr_t guard_secret;
+
+#ifdef HMM_THREAD_SAFE
+static _Thread_local Quarantine quarantine;  // Every thread holds back its own frees, without a lock
+static pthread_once_t guard_once = PTHREAD_ONCE_INIT;
+
+// Key whose destructor frees a thread's quarantined objects when it exits
+static pthread_key_t quarantine_key;
+static pthread_once_t quarantine_key_once = PTHREAD_ONCE_INIT;
+#else
+static Quarantine quarantine;
+#endif
+
+// The guarded public functions near the end of the file wrap the real ones, which get internal names here
+#define HmmAlloc unguarded_alloc
+#define HmmFree unguarded_free
+#define HmmFreeSized unguarded_free_sized
+#define HmmRealloc unguarded_realloc
+#define HmmCalloc unguarded_calloc
+#define HmmAllocBatch unguarded_alloc_batch
+#define HmmFreeBatch unguarded_free_batch
+#define HmmAllocAligned unguarded_alloc_aligned
+#define HmmUsableSize unguarded_usable_size
+#endif
+
+#ifdef HMM_PROFILE
+#include <execinfo.h>
+
+#ifndef HMM_PROFILE_RATE
+#define HMM_PROFILE_RATE (512 * 1024)  // Mean bytes allocated between two samples
+#endif
+#ifndef HMM_PROFILE_DEPTH
+#define HMM_PROFILE_DEPTH 32           // Most frames kept of a sampled call stack
+#endif
+#define PROFILE_STACKS 4096            // Distinct call stacks the profile can tell apart, a power of two
+#define PROFILE_LIVE 16384             // Sampled blocks that can be live at once, a power of two
+#define PROFILE_FILTER 16384           // Counters of the filter every free looks at, a power of two
+#define PROFILE_SKIP 1                 // Frames of profile_sample() itself at the top of a backtrace
+#define PROFILE_MIX 0x9e3779b97f4a7c15ULL  // Odd multiplier spreading an address over the whole word
+#define PROFILE_HASH(ptr, slots) ((size_t)((((uint64_t)(uintptr_t)(ptr) >> 3) * PROFILE_MIX) >> 40) & ((slots) - 1))
+
+// One call stack that allocated sampled blocks, with the samples it made
+typedef struct ProfileStack
+{
+    void *frames[HMM_PROFILE_DEPTH];  // Return addresses, innermost first
+    int depth;                        // Frames in use, 0 while the slot is empty
+    size_t live_count;                // Sampled blocks still allocated
+    size_t live_bytes;                // Their requested bytes
+    size_t alloc_count;               // Sampled blocks ever allocated
+    size_t alloc_bytes;               // Their requested bytes
+} ProfileStack;
+
+// Sampled block that is still allocated
+typedef struct ProfileBlock
+{
+    void *ptr;       // Pointer handed out, NULL while the slot is empty
+    size_t size;     // Bytes requested
+    size_t stack;    // Slot of its call stack in profile_stacks
+} ProfileBlock;
+
+static ProfileStack profile_stacks[PROFILE_STACKS];
+static ProfileBlock profile_live[PROFILE_LIVE];   // Open addressing on the pointer, linear probing
+static size_t profile_live_count;                 // Slots in use in profile_live
+static size_t profile_stack_count;                // Slots in use in profile_stacks
+
+#ifdef HMM_THREAD_SAFE
+// Frees check the filter without a lock; a non-zero counter means a sampled block may hash there
+static _Atomic uint8_t profile_filter[PROFILE_FILTER];
+#define FILTER_LOAD(index) atomic_load_explicit(&profile_filter[index], memory_order_relaxed)
+#define FILTER_STORE(index, value) atomic_store_explicit(&profile_filter[index], (value), memory_order_relaxed)
+
+// Recursive, because writing the profile may allocate through stdio and come back in
+static pthread_mutex_t profile_lock;
+static pthread_once_t profile_once = PTHREAD_ONCE_INIT;
+#define PROFILE_LOCK() (pthread_once(&profile_once, profile_init), pthread_mutex_lock(&profile_lock))
+#define PROFILE_UNLOCK() pthread_mutex_unlock(&profile_lock)
+
+static _Thread_local intptr_t profile_countdown;  // Bytes left before the next sample, per thread so allocations never share it
+static _Thread_local uint64_t profile_random;     // State of the generator of sample intervals, 0 until the thread's first call
+static _Thread_local int profile_busy;            // Set while the thread takes a backtrace, which may allocate
+#else
+static uint8_t profile_filter[PROFILE_FILTER];
+#define FILTER_LOAD(index) (profile_filter[index])
+#define FILTER_STORE(index, value) (profile_filter[index] = (value))
+
+#define PROFILE_LOCK() ((void)0)
+#define PROFILE_UNLOCK() ((void)0)
+
+static intptr_t profile_countdown;
+static uint64_t profile_random;
+static int profile_busy;
+#endif
+
+// Whether an allocation of size bytes is sampled: a subtraction and a branch for all the others
+#define PROFILE_DUE(size) ((profile_countdown -= (intptr_t)(size)) < 0)
+// Whether a pointer may be sampled: one byte load for all the others
+#define PROFILE_MAYBE(ptr) (FILTER_LOAD(PROFILE_HASH(ptr, PROFILE_FILTER)) != 0)
+
+// The profiled public functions near the end of the file wrap the real ones, which get internal names here
+#ifndef HMM_HARDENED
+#define HmmAlloc unprofiled_alloc
+#define HmmFree unprofiled_free
+#define HmmFreeSized unprofiled_free_sized
+#define HmmRealloc unprofiled_realloc
+#define HmmCalloc unprofiled_calloc
+#define HmmAllocBatch unprofiled_alloc_batch
+#define HmmFreeBatch unprofiled_free_batch
+#define HmmAllocAligned unprofiled_alloc_aligned
+#endif
+#endif
+
+#ifdef HMM_TRACE
+#include <stdlib.h>
+#include <time.h>
+#include "../HMM_Trace/hmm_trace.h"
+
+#define TRACE_BUFFER_SIZE (64 * 1024)  // Records are written to the trace file in blocks of this size
+
+// The traced public functions at the end of the file wrap the real ones, which get internal names here;
+// with HMM_HARDENED or HMM_PROFILE those are the guarded or profiled functions, which take the names when they are defined
+#if !defined(HMM_HARDENED) && !defined(HMM_PROFILE)
+#define HmmAlloc untraced_alloc
+#define HmmFree untraced_free
+#define HmmFreeSized untraced_free_sized
+#define HmmRealloc untraced_realloc
+#define HmmCalloc untraced_calloc
+#define HmmAllocBatch untraced_alloc_batch
+#define HmmFreeBatch untraced_free_batch
+#define HmmAllocAligned untraced_alloc_aligned
+#endif
+
+static FILE *trace_file;                        // Trace being written, opened on the first call
+static int trace_failed;                        // The trace file could not be opened
+static uint8_t trace_buffer[TRACE_BUFFER_SIZE]; // Encoded records not written yet
+static size_t trace_used;                       // Bytes used in trace_buffer
+static TraceRecord trace_prev;                  // Last record, records are encoded relative to it
+static uint64_t trace_start;                    // Clock reading when the trace was opened
+#ifdef HMM_THREAD_SAFE
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint trace_threads;               // Number of thread ids handed out
+static _Thread_local uint32_t trace_thread;     // Id of this thread in the trace, 0 until its first call
+static _Thread_local int trace_busy;            // Set while this thread writes a record
+#else
+static int trace_busy;
+#endif
+#endif
+
+// Function prototypes
+#if defined(HMM_LAZY_COALESCE) && defined(HMM_THREAD_SAFE)
+static void *coalesce_thread(void *arg);
+#endif
+#ifdef HMM_PERSISTENT
+static int open_heap_file(const char *path, int *created);
+static void discard_heap_file(int fd, const char *path, int created);
+static void rebase_arena(HmmArena *arena, uintptr_t delta);
+#endif
+static void zero_memory(void *ptr, size_t size);
+static int compare_pointers(const void *a, const void *b);
+#ifdef HMM_HUGEPAGES
+static void advise_huge_pages(void *start, size_t length);
+#endif
+static void *heap_alloc(size_t size);
+static void heap_free(void *ptr);
+static size_t bin_index(size_t size);
+#ifdef HMM_TLSF
+static size_t tlsf_search_index(size_t size);
+static size_t tlsf_find_bin(HmmArena *arena, size_t index);
+#endif
+static BlockHeader *allocate_block(HmmArena *arena, size_t size);
+static BlockHeader *allocate_aligned_block(HmmArena *arena, size_t size, size_t alignment);
+static void release_block(HmmArena *arena, BlockHeader *block);
+static void free_block(HmmArena *arena, BlockHeader *block);
+#ifdef HMM_LAZY_COALESCE
+static void coalesce_pending(HmmArena *arena);
+#endif
+static int resize_block(HmmArena *arena, BlockHeader *block, size_t size);
+static size_t extension_size(HmmArena *arena, size_t needed);
+static void *extend_heap(HmmArena *arena, size_t increment);
+#if defined(HMM_USE_MMAP) || defined(HMM_REDUCED)
+static void trim_heap(HmmArena *arena);
+static void release_pages(void *start, void *end);
+#endif
+#ifdef HMM_USE_MMAP
+static int reserve_heap(void);
+#ifdef HMM_NUMA
+static int current_node(void);
+static void bind_to_node(void *start, size_t length, int node);
+#endif
+static void *map_block(size_t size);
+static void *map_aligned_block(size_t size, size_t alignment);
+static void unmap_block(void *ptr);
+static void *remap_block(void *ptr, size_t size);
+#endif
+static BlockHeader *find_free_block(HmmArena *arena, size_t size);
+static void split_block(HmmArena *arena, BlockHeader *block, size_t size);
+static void add_to_free_list(HmmArena *arena, BlockHeader *block);
+static void remove_from_free_list(HmmArena *arena, BlockHeader *block);
+#ifdef HMM_BEST_FIT
+static BlockHeader *tree_find(HmmArena *arena, size_t size);
+#ifdef HMM_STATS
+static BlockHeader *tree_next(BlockHeader *block);
+#endif
+static void tree_insert(HmmArena *arena, BlockHeader *block);
+static void tree_remove(HmmArena *arena, BlockHeader *block);
+static void tree_rotate(HmmArena *arena, BlockHeader *block, int dir);
+static void tree_replace_child(HmmArena *arena, BlockHeader *parent, BlockHeader *old_child, BlockHeader *new_child);
+#endif
+static BlockHeader *merge_free_blocks(HmmArena *arena, BlockHeader *block);
+static void set_boundary_tag(HmmArena *arena, BlockHeader *block);
+static void slab_free(void *ptr);
+#ifndef HMM_NUMA
+static void *slab_alloc(size_t size);
+static Slab *slab_create(size_t size);
+#endif
+static void slab_unlink(Slab *slab);
+#ifdef HMM_THREAD_SAFE
+static ThreadCache *get_thread_cache(void);
+static void *tcache_alloc(size_t size);
+static void tcache_free(void *ptr, size_t size);
+static void tcache_drain(ThreadCache *cache, size_t index, unsigned int count);
+static void tcache_adopt_remote(ThreadCache *cache, size_t index);
+static void tcache_flush(void *cache);
+static void tcache_create_key(void);
+static void lockfree_push(_Atomic(void *) *stack, void *ptr);
+static void unlock_heap(void);
+#endif
+#ifdef HMM_HARDENED
+static uintptr_t guard_key(void);
+static void guard_init(void);
+static void *guard_object(void *ptr);
+static size_t guard_check(void *ptr, uintptr_t state);
+static void guard_release(void *ptr, size_t size);
+static void guard_fail(const char *what, void *ptr);
+static void quarantine_push(void *ptr, size_t size, size_t usable);
+static void quarantine_evict(Quarantine *q);
+#ifdef HMM_THREAD_SAFE
+static void quarantine_flush(void *q);
+static void quarantine_create_key(void);
+#endif
+#endif
+#ifdef HMM_PROFILE
+static void profile_sample(void *ptr, size_t size);
+static int profile_forget(void *ptr, size_t *size, size_t *stack);
+static void profile_remember(void *ptr, size_t size, size_t stack);
+static size_t profile_find_stack(void **frames, int depth);
+static intptr_t profile_interval(void);
+#ifdef HMM_THREAD_SAFE
+static void profile_init(void);
+#endif
+#endif
+#ifdef HMM_TRACE
+static void trace_record(uint8_t op, void *ptr, void *old_ptr, size_t size);
+static void trace_write(uint8_t op, void *ptr, void *old_ptr, size_t size);
+static void trace_flush(void);
+#endif
+#ifdef HMM_STATS
+static void stats_add_arena(HmmStatistics *stats, HmmArena *arena);
+static void dump_arena(FILE *out, HmmArena *arena);
+#ifdef HMM_THREAD_SAFE
+static ThreadStats *get_thread_stats(void);
+static void stats_retire(void *stats);
+static void stats_create_key(void);
+#endif
+#endif
+
+// The public functions defined here are only visible to the wrappers of HMM_HARDENED, HMM_PROFILE and HMM_TRACE
+// when those take over their names; a wrapper layer may leave some of them unused
+#if defined(HMM_HARDENED) || defined(HMM_PROFILE) || defined(HMM_TRACE)
+#define HMM_WRAPPED static __attribute__((unused))
+#else
+#define HMM_WRAPPED
+#endif
+#ifdef HMM_HARDENED
+#define HMM_GUARD_WRAPPED static
+#else
+#define HMM_GUARD_WRAPPED
+#endif
+
+// Function to allocate memory of the specified size
+HMM_WRAPPED void *HmmAlloc(size_t size)
+{
+
+    if (size == 0) 
+    {
+        return NULL;  // If size is 0, return NULL as there's nothing to allocate
+    }
+
+    size = ALIGN(size);  // Align the requested size to HMM_ALIGNMENT
+#ifdef HMM_CACHE_ALIGNED
+    if (size <= SLAB_MAX_OBJECT)
+    {
+        size = CACHE_ALIGN(size);  // Small objects take whole cache lines, so no two of them share one
+    }
+#endif
+    STAT_ADD(alloc_calls, 1);
+
+#ifdef HMM_USE_MMAP
+    if (size >= MMAP_THRESHOLD)
+    {
+        return map_block(size);  // Huge requests bypass the heap, and need no lock
+    }
+#endif
+
+#ifdef HMM_THREAD_SAFE
+    if (size <= TCACHE_MAX_SIZE)
+    {
+        return tcache_alloc(size);  // Small sizes are served from the thread cache without the lock
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    void *ptr = heap_alloc(size);
+    unlock_heap();
+    return ptr;
+#else
+    return heap_alloc(size);
+#endif
+}
+
+// Function to free a previously allocated block of memory
+HMM_WRAPPED void HmmFree(void *ptr)
+{
+    if (ptr == NULL) 
+    {
+        return;  // If the pointer is NULL, there is nothing to free
+    }
+    STAT_ADD(free_calls, 1);
+
+#ifdef HMM_USE_MMAP
+    if (IS_MAPPED_POINTER(ptr))
+    {
+        unmap_block(ptr);  // Directly mapped blocks go straight back to the OS
+        return;
+    }
+#endif
+
+#ifdef HMM_NUMA
+    if (ARENA_OF(ptr) != LOCAL_ARENA())
+    {
+        STAT_ADD(node_remote_frees, 1);  // Memory of another node, it goes back to that node's arena
+    }
+#endif
+
+#ifdef HMM_THREAD_SAFE
+    // Slab objects have no header, their size comes from the slab they sit in
+    size_t size = IS_SLAB_POINTER(ptr) ? SLAB_FROM_POINTER(ptr)->object_size : BLOCK_SIZE((BlockHeader *)ptr - 1);
+    if (size <= TCACHE_MAX_SIZE && IS_CACHEABLE(ptr) && ARENA_OF(ptr) == LOCAL_ARENA())
+    {
+        tcache_free(ptr, size);  // Small objects of this thread's node go back to the thread cache without the lock
+        return;
+    }
+
+    if (pthread_mutex_trylock(&heap_lock) != 0)
+    {
+        lockfree_push(&deferred_frees, ptr);  // Never wait: the lock holder applies it on unlock
+        STAT_ADD(deferred_frees, 1);
+        return;
+    }
+    heap_free(ptr);
+    unlock_heap();
+#else
+    heap_free(ptr);
+#endif
+}
+
+// Function to free a block of a known size, the one it was allocated or last resized with, sending small blocks
+// straight to their thread cache class without reading the block header or the slab it sits in
+HMM_WRAPPED void HmmFreeSized(void *ptr, size_t size)
+{
+#ifdef HMM_THREAD_SAFE
+    if (ptr == NULL || size == 0)
+    {
+        HmmFree(ptr);  // Nothing to free, or no size to go by
+        return;
+    }
+
+    size = ALIGN(size);  // The class the block was allocated from, as HmmAlloc() computed it
+#ifdef HMM_CACHE_ALIGNED
+    if (size <= SLAB_MAX_OBJECT)
+    {
+        size = CACHE_ALIGN(size);
+    }
+#endif
+    if (size <= TCACHE_MAX_SIZE && IS_CACHEABLE(ptr) && ARENA_OF(ptr) == LOCAL_ARENA())
+    {
+        STAT_ADD(free_calls, 1);
+        tcache_free(ptr, size);  // A block is never smaller than its class, so the cache can hand it out again as is
+        return;
+    }
+#else
+    (void)size;  // Without the thread caches the block is merged or its slab updated, which reads the header anyway
+#endif
+    HmmFree(ptr);
+}
+
+// Function to resize a previously allocated block, in place whenever possible
+HMM_WRAPPED void *HmmRealloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return HmmAlloc(size);  // Nothing to resize, behave like HmmAlloc
+    }
+    if (size == 0)
+    {
+        HmmFree(ptr);  // Resizing to nothing frees the block
+        return NULL;
+    }
+
+    size = ALIGN(size);  // Align the requested size to HMM_ALIGNMENT
+#ifdef HMM_CACHE_ALIGNED
+    if (size <= SLAB_MAX_OBJECT)
+    {
+        size = CACHE_ALIGN(size);  // Like HmmAlloc(), so HmmFreeSized() finds the same class
+    }
+#endif
+    STAT_ADD(realloc_calls, 1);
+
+    size_t old_size;
+#ifdef HMM_USE_MMAP
+    if (IS_MAPPED_POINTER(ptr))
+    {
+        old_size = BLOCK_SIZE((BlockHeader *)ptr - 1);
+        if (size >= MMAP_THRESHOLD)
+        {
+            return remap_block(ptr, size);  // Stay mapped and let the kernel move the pages
+        }
+        // Shrinking below the threshold: move the data back into the heap
+    }
+    else
+#endif
+    if (IS_SLAB_POINTER(ptr))
+    {
+        old_size = SLAB_FROM_POINTER(ptr)->object_size;
+        if (size <= old_size)
+        {
+            STAT_ADD(realloc_in_place, 1);
+            return ptr;  // The object still fits in its slot
+        }
+    }
+    else
+    {
+        BlockHeader *block = (BlockHeader *)ptr - 1;  // Get the block header associated with the pointer
+
+#ifdef HMM_THREAD_SAFE
+        pthread_mutex_lock(&heap_lock);
+#endif
+        old_size = BLOCK_SIZE(block);
+#ifdef HMM_CACHE_ALIGNED
+        // A block shrunk to a small size would not start on a cache line, so it moves into a slab slot instead
+        int resized = size > SLAB_MAX_OBJECT && resize_block(ARENA_OF(ptr), block, size);
+#else
+        int resized = resize_block(ARENA_OF(ptr), block, size);
+#endif
+#ifdef HMM_THREAD_SAFE
+        unlock_heap();
+#endif
+        if (resized)
+        {
+            STAT_ADD(realloc_in_place, 1);
+            return ptr;
+        }
+    }
+
+    // Last resort: move the data to a new block
+    void *new_ptr = HmmAlloc(size);
+    if (new_ptr == NULL)
+    {
+        return NULL;  // The original block is left untouched
+    }
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    HmmFree(ptr);
+    return new_ptr;
+}
+
+// Function to allocate zero-initialised memory for an array of count elements of the given size
+HMM_WRAPPED void *HmmCalloc(size_t count, size_t size)
+{
+    if (count != 0 && size > SIZE_MAX / count)
+    {
+        return NULL;  // The total size would overflow
+    }
+
+    size_t total = count * size;
+    STAT_ADD(calloc_calls, 1);
+    if (total == 0)
+    {
+        return NULL;  // If size is 0, return NULL as there's nothing to allocate
+    }
+
+    if (ALIGN(total) <= SMALL_BIN_MAX)
+    {
+        // Small objects come from recycled slabs, caches and bins, clearing them is cheaper than tracking them
+        void *ptr = HmmAlloc(total);
+        if (ptr)
+        {
+            memset(ptr, 0, total);
+        }
+        return ptr;
+    }
+
+#ifdef HMM_USE_MMAP
+    if (ALIGN(total) >= MMAP_THRESHOLD)
+    {
+        return map_block(ALIGN(total));  // Fresh pages are already zero
+    }
+#endif
+
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
+#endif
+    void *known_zero = LOCAL_ARENA()->zero_mark;  // Memory at or above the mark has never been handed out
+    void *ptr = heap_alloc(ALIGN(total));
+#ifdef HMM_THREAD_SAFE
+    unlock_heap();
+#endif
+
+    // Only the part of the block below the mark is being reused and may hold old data
+    if (ptr && ptr < known_zero)
+    {
+        size_t dirty = (uintptr_t)known_zero - (uintptr_t)ptr;
+        zero_memory(ptr, dirty < total ? dirty : total);
+    }
+    return ptr;
+}
+
+// Function to allocate count blocks of one size, carving them from a single free block in one pass; returns how many were allocated
+HMM_WRAPPED size_t HmmAllocBatch(size_t size, size_t count, void **out)
+{
+    if (size == 0 || count == 0)
+    {
+        return 0;  // Nothing to allocate
+    }
+
+    size = ALIGN(size);  // Align the requested size to HMM_ALIGNMENT
+    if (size < MIN_PAYLOAD)
+    {
+        size = MIN_PAYLOAD;  // Every block must be able to hold its free-list links once it is freed
+    }
+
+    // The blocks sit back to back, so together they need one block of count * stride minus the first header
+    size_t stride = HEADER_SIZE + size;
+    size_t carved = 0;
+    int carve = count <= SIZE_MAX / stride;
+#ifdef HMM_CACHE_ALIGNED
+    carve = carve && size > SLAB_MAX_OBJECT;  // Carved blocks would not be cache-line aligned, small objects come from the slabs
+#endif
+    if (carve)
+    {
+#ifdef HMM_THREAD_SAFE
+        pthread_mutex_lock(&heap_lock);
+#endif
+        HmmArena *arena = LOCAL_ARENA();
+        BlockHeader *block = allocate_block(arena, count * stride - HEADER_SIZE);  // One search and one split for the whole batch
+        if (block)
+        {
+            size_t leftover = BLOCK_SIZE(block) - (count * stride - HEADER_SIZE);  // Too small to have been split off
+            int was_last = block == arena->last_block;
+
+            SET_BLOCK_SIZE(block, size);
+            out[carved++] = block + 1;
+            for (; carved < count; carved++)
+            {
+                block = (BlockHeader *)((uintptr_t)block + stride);
+                INIT_HEADER(block, size, 0, 0);  // Allocated, and so is the block before it
+                out[carved] = block + 1;
+            }
+            SET_BLOCK_SIZE(block, size + leftover);
+            if (was_last)
+            {
+                arena->last_block = block;
+            }
+
+            STAT_ADD(alloc_calls, count);
+            STAT_ADD(splits, count - 1);
+            STAT_ADD(bytes_freed, (count - 1) * HEADER_SIZE);  // allocate_block() counted the carved headers as payload
+        }
+#ifdef HMM_THREAD_SAFE
+        unlock_heap();
+#endif
+    }
+
+    // No single free block or extension could hold the batch, allocate the rest one by one
+    for (; carved < count; carved++)
+    {
+        out[carved] = HmmAlloc(size);
+        if (out[carved] == NULL)
+        {
+            break;  // The heap is exhausted, keep whatever was allocated so far
+        }
+    }
+    return carved;
+}
+
+// Function to free many blocks at once, sorting them by address so neighbours are merged in one sweep; ptrs is reordered
+HMM_WRAPPED void HmmFreeBatch(void **ptrs, size_t count)
+{
+    // Slab objects and directly mapped blocks take the usual path, heap blocks are gathered at the front
+    size_t blocks = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (ptrs[i] == NULL)
+        {
+            continue;  // Freeing NULL does nothing
+        }
+        if (!IS_HEAP_POINTER(ptrs[i]))
+        {
+            HmmFree(ptrs[i]);
+            continue;
+        }
+        ptrs[blocks++] = ptrs[i];
+    }
+    if (blocks == 0)
+    {
+        return;
+    }
+
+    STAT_ADD(free_calls, blocks);
+    size_t sorted = 1;
+    while (sorted < blocks && (uintptr_t)ptrs[sorted - 1] < (uintptr_t)ptrs[sorted])
+    {
+        sorted++;
+    }
+    if (sorted < blocks)
+    {
+        qsort(ptrs, blocks, sizeof(void *), compare_pointers);  // A batch from HmmAllocBatch() usually comes back in order
+    }
+
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
+#endif
+    for (size_t i = 0; i < blocks;)
+    {
+        BlockHeader *run = (BlockHeader *)ptrs[i++] - 1;
+        BlockHeader *end = run;
+        size_t joined_blocks = 0;
+        HmmArena *arena = ARENA_OF(run);
+
+        // Blocks that follow the run directly in memory join it for the cost of an address comparison
+        while (i < blocks && (BlockHeader *)ptrs[i] - 1 == NEXT_PHYSICAL(end) && ARENA_OF(ptrs[i]) == arena)
+        {
+            end = (BlockHeader *)ptrs[i++] - 1;
+            joined_blocks++;
+        }
+        if (joined_blocks)
+        {
+            size_t joined = (uintptr_t)NEXT_PHYSICAL(end) - (uintptr_t)(run + 1);
+            STAT_ADD(merges, joined_blocks);
+            STAT_ADD(bytes_allocated, joined_blocks * HEADER_SIZE);  // release_block() counts the joined headers as payload too
+            if (end == arena->last_block)
+            {
+                arena->last_block = run;
+            }
+            SET_BLOCK_SIZE(run, joined);
+        }
+
+        // Only the ends of the run can have free neighbours
+        release_block(arena, run);
+    }
+#ifdef HMM_THREAD_SAFE
+    unlock_heap();
+#endif
+}
+
+// Function to allocate memory at a multiple of alignment, a power of two such as CACHE_LINE_SIZE, a page or a huge page
+HMM_WRAPPED void *HmmAllocAligned(size_t size, size_t alignment)
+{
+    if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        return NULL;  // Nothing to allocate, or the alignment is not a power of two
+    }
+    if (alignment <= HMM_ALIGNMENT)
+    {
+        return HmmAlloc(size);  // Every payload is already HMM_ALIGNMENT aligned
+    }
+#ifdef HMM_CACHE_ALIGNED
+    if (alignment <= CACHE_LINE_SIZE && ALIGN(size) <= SLAB_MAX_OBJECT)
+    {
+        return HmmAlloc(size);  // Small objects are already cache-line aligned
+    }
+#endif
+
+    size = ALIGN(size);  // Align the requested size to HMM_ALIGNMENT
+#ifdef HMM_CACHE_ALIGNED
+    if (size <= SLAB_MAX_OBJECT)
+    {
+        size = CACHE_ALIGN(size);  // Like HmmAlloc(), so the block is as large as the class HmmFreeSized() sends it to
+    }
+#endif
+    STAT_ADD(alloc_calls, 1);
+    STAT_ADD(aligned_allocs, 1);
+
+#ifdef HMM_USE_MMAP
+    if (size >= MMAP_THRESHOLD)
+    {
+        return map_aligned_block(size, alignment);  // Huge requests bypass the heap, and need no lock
+    }
+#endif
+
+    // Slab objects and cached blocks have no room to move, so aligned memory always comes from a fresh block
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
+#endif
+    BlockHeader *block = allocate_aligned_block(LOCAL_ARENA(), size, alignment);
+#ifdef HMM_THREAD_SAFE
+    unlock_heap();
+#endif
+    if (block == NULL)
+    {
+        STAT_ADD(failed_allocs, 1);
+        return NULL;
+    }
+    return (void *)(block + 1);
+}
+
+// Function to get the bytes usable at an allocated pointer, which may be more than were asked for
+HMM_GUARD_WRAPPED size_t HmmUsableSize(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return 0;
+    }
+    if (IS_SLAB_POINTER(ptr))
+    {
+        return SLAB_FROM_POINTER(ptr)->object_size;  // The whole slot belongs to the object
+    }
+    return BLOCK_SIZE((BlockHeader *)ptr - 1);  // Heap and mapped blocks both keep their payload size in the header
+}
+
+// Function to set up an independent arena in a caller-supplied buffer, returning NULL if the buffer is too small
+HmmArena *HmmArenaCreate(void *buffer, size_t size)
+{
+    // The arena's state sits at the start of the buffer, its heap in the rest
+    uintptr_t start = ALIGN((uintptr_t)buffer);
+    uintptr_t heap_start = ALIGN(start + sizeof(HmmArena));
+    uintptr_t end = (uintptr_t)buffer + size;
+    if (buffer == NULL || end < heap_start + HEADER_SIZE + MIN_PAYLOAD)
+    {
+        return NULL;  // No room for the state and one block
+    }
+
+    HmmArena *arena = (HmmArena *)start;
+    memset(arena, 0, sizeof(*arena));
+    arena->heap = (uint8_t *)heap_start;
+    arena->size = (end - heap_start) & ~(size_t)(HMM_ALIGNMENT - 1);
+    arena->program_break = arena->heap;
+    arena->zero_mark = (void *)end;  // The buffer's contents are unknown, HmmArenaAlloc() does not clear memory anyway
+    arena->os_backed = 0;  // The buffer belongs to the caller, its pages are never committed or released
+#ifdef HMM_STATS
+    arena->peak = arena->heap;
+#endif
+#ifdef HMM_REDUCED
+    arena->growth_step = HMM_CHUNK_SIZE;
+#endif
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_init(&arena->lock, NULL);
+#endif
+    return arena;
+}
+
+// Function to allocate memory of the specified size from an arena
+void *HmmArenaAlloc(HmmArena *arena, size_t size)
+{
+    if (size == 0)
+    {
+        return NULL;  // If size is 0, return NULL as there's nothing to allocate
+    }
+
+    size = ALIGN(size);  // Align the requested size to HMM_ALIGNMENT
+    STAT_ADD(alloc_calls, 1);
+
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    BlockHeader *block = allocate_block(arena, size);
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    if (block == NULL)
+    {
+        STAT_ADD(failed_allocs, 1);
+        return NULL;  // The arena is full
+    }
+    return (void *)(block + 1);
+}
+
+// Function to allocate memory at a multiple of alignment from an arena
+void *HmmArenaAllocAligned(HmmArena *arena, size_t size, size_t alignment)
+{
+    if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        return NULL;  // Nothing to allocate, or the alignment is not a power of two
+    }
+    if (alignment <= HMM_ALIGNMENT)
+    {
+        return HmmArenaAlloc(arena, size);  // Every payload is already HMM_ALIGNMENT aligned
+    }
+
+    size = ALIGN(size);  // Align the requested size to HMM_ALIGNMENT
+    STAT_ADD(alloc_calls, 1);
+    STAT_ADD(aligned_allocs, 1);
+
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    BlockHeader *block = allocate_aligned_block(arena, size, alignment);
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    if (block == NULL)
+    {
+        STAT_ADD(failed_allocs, 1);
+        return NULL;  // The arena is full
+    }
+    return (void *)(block + 1);
+}
+
+// Function to return memory allocated from an arena
+void HmmArenaFree(HmmArena *arena, void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;  // Freeing NULL does nothing
+    }
+
+    STAT_ADD(free_calls, 1);
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    release_block(arena, (BlockHeader *)ptr - 1);
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+}
+
+// Function to resize memory allocated from an arena, keeping it in the same arena
+void *HmmArenaRealloc(HmmArena *arena, void *ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return HmmArenaAlloc(arena, size);  // Nothing to resize, behave like HmmArenaAlloc
+    }
+    if (size == 0)
+    {
+        HmmArenaFree(arena, ptr);  // Resizing to nothing frees the block
+        return NULL;
+    }
+
+    size = ALIGN(size);  // Align the requested size to HMM_ALIGNMENT
+    STAT_ADD(realloc_calls, 1);
+
+    BlockHeader *block = (BlockHeader *)ptr - 1;
+    void *new_ptr = ptr;
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    size_t old_size = BLOCK_SIZE(block);
+    if (resize_block(arena, block, size))
+    {
+        STAT_ADD(realloc_in_place, 1);
+    }
+    else
+    {
+        // Move the data to a new block of the same arena, the old one is left untouched on failure
+        BlockHeader *new_block = allocate_block(arena, size);
+        new_ptr = new_block ? (void *)(new_block + 1) : NULL;
+        if (new_ptr)
+        {
+            memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+            release_block(arena, block);
+        }
+        else
+        {
+            STAT_ADD(failed_allocs, 1);
+        }
+    }
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return new_ptr;
+}
+
+// Function to allocate memory from an arena used as a region, by moving its program break past the request
+void *HmmRegionAlloc(HmmArena *arena, size_t size)
+{
+    if (size == 0)
+    {
+        return NULL;  // If size is 0, return NULL as there's nothing to allocate
+    }
+
+    size = ALIGN(size);  // Align the requested size to HMM_ALIGNMENT
+    STAT_ADD(alloc_calls, 1);
+
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    // No header, no bins: the memory between heap and the program break is simply in use
+    void *ptr = arena->program_break;
+    if (size <= (uintptr_t)arena->heap + arena->size - (uintptr_t)ptr)
+    {
+        arena->program_break = (void *)((uintptr_t)ptr + size);
+#ifdef HMM_STATS
+        if (arena->program_break > arena->peak)
+        {
+            arena->peak = arena->program_break;
+        }
+#endif
+    }
+    else
+    {
+        ptr = NULL;  // The region is full
+    }
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+
+    if (ptr == NULL)
+    {
+        STAT_ADD(failed_allocs, 1);
+    }
+    return ptr;
+}
+
+// Function to free everything allocated from a region at once, by moving its program break back to the start
+void HmmRegionReset(HmmArena *arena)
+{
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    arena->program_break = arena->heap;
+    arena->last_block = NULL;
+#ifdef HMM_LAZY_COALESCE
+    arena->pending = NULL;
+    arena->pending_bytes = 0;
+#endif
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+}
+
+#ifdef HMM_PERSISTENT
+// Function to open the heap kept in a file, creating a file of the given size if there is none, or NULL with errno set;
+// an existing file keeps its size, and its blocks and root come back as they were when it was last used
+HmmArena *HmmArenaOpen(const char *path, size_t size)
+{
+    int created;
+    int fd = open_heap_file(path, &created);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    HmmArena saved;
+    int existing = fstat(fd, &st) == 0 && st.st_size != 0;
+    if (existing)
+    {
+        if (pread(fd, &saved, sizeof(saved), 0) != (ssize_t)sizeof(saved) || saved.magic != PERSISTENT_MAGIC ||
+            saved.layout != PERSISTENT_LAYOUT || saved.file_size != (size_t)st.st_size)
+        {
+            close(fd);
+            errno = EINVAL;  // Not a heap file, or one made by a build with another layout
+            return NULL;
+        }
+        size = saved.file_size;
+    }
+    else if (ftruncate(fd, (off_t)size) != 0)
+    {
+        discard_heap_file(fd, path, created);
+        return NULL;
+    }
+
+    // Asking for the previous address usually gets it, and then nothing needs to move
+    void *base = mmap(existing ? saved.base : NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        if (existing)
+        {
+            close(fd);
+        }
+        else
+        {
+            discard_heap_file(fd, path, created);
+        }
+        return NULL;
+    }
+
+    HmmArena *arena = (HmmArena *)base;
+    if (existing)
+    {
+        rebase_arena(arena, (uintptr_t)base - (uintptr_t)saved.base);
+#ifdef HMM_THREAD_SAFE
+        pthread_mutex_init(&arena->lock, NULL);  // The lock belonged to the previous process
+#endif
+    }
+    else
+    {
+        arena = HmmArenaCreate(base, size);
+        if (arena == NULL)
+        {
+            munmap(base, size);
+            errno = EINVAL;  // Too small for the arena's state and one block
+            discard_heap_file(fd, path, created);
+            return NULL;
+        }
+        arena->magic = PERSISTENT_MAGIC;
+        arena->layout = PERSISTENT_LAYOUT;
+        arena->file_size = size;
+    }
+    arena->base = base;
+    arena->fd = fd;
+    return arena;
+}
+
+// Function to open and lock a heap file, creating it if there is none, and to tell whether this call created it;
+// returns the descriptor, or -1 with errno set if the file cannot be opened or another process has it open
+static int open_heap_file(const char *path, int *created)
+{
+    for (;;)
+    {
+        // O_EXCL tells a file made here apart from an empty one that was already there
+        int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        *created = fd >= 0;
+        if (fd < 0 && errno == EEXIST)
+        {
+            fd = open(path, O_RDWR | O_CLOEXEC);
+            if (fd < 0 && errno == ENOENT)
+            {
+                continue;  // Removed between the two calls
+            }
+        }
+        if (fd < 0)
+        {
+            return -1;
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+        {
+            close(fd);
+            return -1;  // Another process has the heap open
+        }
+
+        // The lock may have been won on a file that a failed HmmArenaOpen() removed in the meantime
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_nlink == 0)
+        {
+            close(fd);
+            continue;
+        }
+        return fd;
+    }
+}
+
+// Function to undo the set-up of a new heap file that failed, keeping errno: a file this call created is removed,
+// an empty one that was already there is emptied again; both happen before close() gives up the lock
+static void discard_heap_file(int fd, const char *path, int created)
+{
+    int error = errno;
+
+    if (created)
+    {
+        unlink(path);
+    }
+    else if (ftruncate(fd, 0) != 0)
+    {
+        // Nothing more can be done; the caller reports the first error
+    }
+    close(fd);
+    errno = error;
+}
+
+// Function to move the pointers of an arena's state by the distance its file moved since it was last mapped;
+// the free-list links are relative to their blocks, so only the arena itself needs it
+static void rebase_arena(HmmArena *arena, uintptr_t delta)
+{
+    if (delta == 0)
+    {
+        return;
+    }
+
+    arena->heap = REBASE(arena->heap, delta);
+    arena->program_break = REBASE(arena->program_break, delta);
+    arena->zero_mark = REBASE(arena->zero_mark, delta);
+    arena->last_block = REBASE(arena->last_block, delta);
+    for (size_t index = 0; index < NUM_BINS; index++)
+    {
+        arena->free_lists[index] = REBASE(arena->free_lists[index], delta);
+    }
+#ifdef HMM_LAZY_COALESCE
+    arena->pending = REBASE(arena->pending, delta);
+#endif
+#ifdef HMM_STATS
+    arena->peak = REBASE(arena->peak, delta);
+#endif
+}
+
+// Function to write the heap file's dirty pages to disk, returning 0 on success
+int HmmArenaSync(HmmArena *arena)
+{
+    return msync(arena->base, arena->file_size, MS_SYNC);
+}
+
+// Function to close a heap file, leaving its blocks in the file for the next HmmArenaOpen()
+void HmmArenaClose(HmmArena *arena)
+{
+    int fd = arena->fd;
+    size_t size = arena->file_size;
+    msync(arena->base, size, MS_SYNC);
+    munmap(arena->base, size);
+    close(fd);  // Also releases the lock
+}
+
+// Function to record the object a reopened heap file should be entered through, such as the root of an index
+void HmmArenaSetRoot(HmmArena *arena, void *ptr)
+{
+    arena->root = ptr ? (uintptr_t)ptr - (uintptr_t)arena : 0;  // Kept as an offset, which survives a move
+}
+
+// Function to get the object recorded by HmmArenaSetRoot(), or NULL if there is none
+void *HmmArenaRoot(HmmArena *arena)
+{
+    return arena->root ? (void *)((uintptr_t)arena + arena->root) : NULL;
+}
+#endif
+
+#ifdef HMM_LAZY_COALESCE
+// Function to merge the pending frees of the heap right away, e.g. from an idle loop
+void HmmCoalesce(void)
+{
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
+#endif
+#ifdef HMM_NUMA
+    for (int node = 0; node < HMM_MAX_NODES; node++)
+    {
+        coalesce_pending(&node_arenas[node]);
+    }
+#else
+    coalesce_pending(&main_arena);
+#endif
+#ifdef HMM_THREAD_SAFE
+    unlock_heap();
+#endif
+}
+
+#ifdef HMM_THREAD_SAFE
+// Function to start a detached thread that merges the pending frees every COALESCE_INTERVAL_MS, returning 0 on success
+int HmmStartCoalescer(void)
+{
+    pthread_t thread;
+    int error = pthread_create(&thread, NULL, coalesce_thread, NULL);
+    if (error == 0)
+    {
+        pthread_detach(thread);
+    }
+    return error;
+}
+
+// Function run by the background coalescing thread
+static void *coalesce_thread(void *arg)
+{
+    (void)arg;
+    struct timespec interval = { COALESCE_INTERVAL_MS / 1000, (COALESCE_INTERVAL_MS % 1000) * 1000000L };
+    for (;;)
+    {
+        nanosleep(&interval, NULL);
+        HmmCoalesce();
+    }
+    return NULL;
+}
+#endif
+#endif
+
+// Function to clear memory, streaming large ranges past the cache
+static void zero_memory(void *ptr, size_t size)
+{
+#ifdef __SSE2__
+    if (size >= ZERO_STREAM_THRESHOLD)
+    {
+        // Clear up to the first 16-byte boundary normally, then stream whole 64-byte lines
+        size_t head = (16 - ((uintptr_t)ptr & 15)) & 15;
+        memset(ptr, 0, head);
+
+        __m128i zero = _mm_setzero_si128();
+        __m128i *line = (__m128i *)((uintptr_t)ptr + head);
+        size_t lines = (size - head) / 64;
+        for (size_t i = 0; i < lines; i++, line += 4)
+        {
+            _mm_stream_si128(line, zero);
+            _mm_stream_si128(line + 1, zero);
+            _mm_stream_si128(line + 2, zero);
+            _mm_stream_si128(line + 3, zero);
+        }
+        _mm_sfence();  // Make the streamed stores visible before the memory is handed out
+
+        memset(line, 0, (size - head) % 64);  // The tail that does not fill a whole line
+        return;
+    }
+#endif
+    memset(ptr, 0, size);
+}
+
+// Function to order two pointers by address for qsort()
+static int compare_pointers(const void *a, const void *b)
+{
+    uintptr_t left = (uintptr_t)*(void *const *)a;
+    uintptr_t right = (uintptr_t)*(void *const *)b;
+    return (left > right) - (left < right);
+}
+
+#ifdef HMM_HUGEPAGES
+// Function to ask the kernel to back a huge-page-aligned range with transparent huge pages
+static void advise_huge_pages(void *start, size_t length)
+{
+#ifdef MADV_HUGEPAGE
+    madvise(start, length, MADV_HUGEPAGE);  // Only a hint: without THP the range keeps normal pages
+#else
+    (void)start;
+    (void)length;
+#endif
+}
+#endif
+
+// Function to allocate an aligned size from the slabs or the block heap, called with heap_lock held in the thread-safe mode
+static void *heap_alloc(size_t size)
+{
+    // The slab area is shared by every node, so with HMM_NUMA small requests come from the node's own blocks as well
+#ifndef HMM_NUMA
+    if (size <= SLAB_MAX_OBJECT)
+    {
+        void *ptr = slab_alloc(size);
+        if (ptr)
+        {
+            return ptr;
+        }
+        // The slab area is full, fall back to a regular block
+#ifdef HMM_CACHE_ALIGNED
+        BlockHeader *aligned = allocate_aligned_block(LOCAL_ARENA(), size, CACHE_LINE_SIZE);  // Still on cache lines of its own
+        if (aligned == NULL)
+        {
+            STAT_ADD(failed_allocs, 1);
+            return NULL;
+        }
+        return (void *)(aligned + 1);
+#endif
+    }
+#endif
+
+    // Attempt to find a suitable free block in the free list
+    BlockHeader *block = allocate_block(LOCAL_ARENA(), size);
+    if (block == NULL)
+    {
+        STAT_ADD(failed_allocs, 1);
+        return NULL;  // If no suitable block is found, return NULL
+    }
+
+    return (void *)(block + 1);  // Return a pointer to the memory just after the block header
+}
+
+// Function to free a slab object or a block, called with heap_lock held in the thread-safe mode
+static void heap_free(void *ptr)
+{
+    if (IS_SLAB_POINTER(ptr))
+    {
+        slab_free(ptr);
+        return;
+    }
+
+    release_block(ARENA_OF(ptr), (BlockHeader *)ptr - 1);  // Get the block header associated with the pointer
+}
+
+// Function to take a block of the given aligned size out of the heap and mark it allocated
+static BlockHeader *allocate_block(HmmArena *arena, size_t size)
+{
+    if (size < MIN_PAYLOAD)
+    {
+        size = MIN_PAYLOAD;  // The block must be able to hold its free-list links once it is freed
+    }
+
+#ifdef HMM_LAZY_COALESCE
+    // The most recent free is still marked allocated, so a request it fits without a split takes it as is
+    BlockHeader *recent = arena->pending;
+    if (recent && BLOCK_SIZE(recent) >= size && BLOCK_SIZE(recent) < size + HEADER_SIZE + MIN_PAYLOAD)
+    {
+        arena->pending = FREE_NEXT(recent);
+        arena->pending_bytes -= BLOCK_SIZE(recent);
+        STAT_ADD(bytes_allocated, BLOCK_SIZE(recent));
+        return recent;
+    }
+#endif
+
+    // Attempt to find a suitable free block in the free list
+    BlockHeader *block = find_free_block(arena, size);
+    if (block == NULL)
+    {
+        return NULL;  // If no suitable block is found, return NULL
+    }
+
+    SET_FREE(block, 0);  // Mark the block as allocated
+    if ((void *)NEXT_PHYSICAL(block) < arena->program_break)
+    {
+        SET_PREV_FREE(NEXT_PHYSICAL(block), 0);  // Its neighbour must no longer look back through a footer
+    }
+    STAT_ADD(bytes_allocated, BLOCK_SIZE(block));
+    return block;
+}
+
+// Function to take a block whose payload is a multiple of alignment out of the heap, giving the padding around it back
+static BlockHeader *allocate_aligned_block(HmmArena *arena, size_t size, size_t alignment)
+{
+    if (size < MIN_PAYLOAD)
+    {
+        size = MIN_PAYLOAD;  // The block must be able to hold its free-list links once it is freed
+    }
+
+    // Room for the payload to slide up to an aligned address, leaving a free block of padding in front of it
+    size_t padded = size + alignment + HEADER_SIZE + MIN_PAYLOAD;
+    if (padded < size)
+    {
+        return NULL;  // The size overflowed
+    }
+    BlockHeader *block = allocate_block(arena, padded);
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    uintptr_t payload = (uintptr_t)(block + 1);
+    if (payload & (alignment - 1))
+    {
+        // Move the header up to just before the next aligned address that leaves room for the padding block
+        payload = (payload + HEADER_SIZE + MIN_PAYLOAD + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        BlockHeader *aligned = (BlockHeader *)payload - 1;
+        size_t lead = (uintptr_t)aligned - (uintptr_t)block;
+        INIT_HEADER(aligned, BLOCK_SIZE(block) - lead, 0, 0);
+        if (block == arena->last_block)
+        {
+            arena->last_block = aligned;
+        }
+
+        SET_BLOCK_SIZE(block, lead - HEADER_SIZE);
+        STAT_ADD(bytes_freed, lead);  // The padding and the new header are no longer handed out
+        free_block(arena, block);  // The padding merges with a free block before it, if any
+        block = aligned;
+    }
+
+#ifdef HMM_STATS
+    size_t old_size = BLOCK_SIZE(block);
+#endif
+    split_block(arena, block, size);  // Give back what the payload does not need
+    STAT_ADD(bytes_freed, old_size - BLOCK_SIZE(block));
+    return block;
+}
+
+// Function to return an allocated block to the heap
+static void release_block(HmmArena *arena, BlockHeader *block)
+{
+    STAT_ADD(bytes_freed, BLOCK_SIZE(block));
+#ifdef HMM_LAZY_COALESCE
+    // Only a push: the block is merged when an allocation misses or enough bytes are pending
+    SET_FREE_NEXT(block, arena->pending);
+    arena->pending = block;
+    arena->pending_bytes += BLOCK_SIZE(block);
+    if (arena->pending_bytes >= LAZY_COALESCE_THRESHOLD)
+    {
+        coalesce_pending(arena);
+    }
+#else
+    free_block(arena, block);
+#endif
+}
+
+// Function to mark a block free, merge it with its free neighbours and put it in its bin
+static void free_block(HmmArena *arena, BlockHeader *block)
+{
+    SET_FREE(block, 1);  // Mark the block as free
+
+    // Merge it with its free neighbours in memory to reduce fragmentation
+    block = merge_free_blocks(arena, block);
+
+    // Add the block back to the free list of its size class
+    add_to_free_list(arena, block);
+
+    // The Reduced strategy trims the top of the heap even in heap[], only HMM_USE_MMAP releases pages inside it
+#if defined(HMM_USE_MMAP) || defined(HMM_REDUCED)
+    if (!arena->os_backed)
+    {
+        return;  // The memory of a created arena belongs to its owner
+    }
+    if (block == arena->last_block && BLOCK_SIZE(block) >= HEAP_TRIM_THRESHOLD)
+    {
+        trim_heap(arena);  // Give the top of the heap back to the OS
+    }
+#ifdef HMM_USE_MMAP
+    else if (BLOCK_SIZE(block) >= HEAP_RELEASE_THRESHOLD)
+    {
+        // Keep the header, the free-list links and the footer, release the whole pages in between
+        release_pages((void *)((uintptr_t)(block + 1) + FREE_LINKS_SIZE), &FOOTER(block));
+    }
+#endif
+#endif
+}
+
+#ifdef HMM_LAZY_COALESCE
+// Function to merge every pending free of an arena, in the order they were freed
+static void coalesce_pending(HmmArena *arena)
+{
+    BlockHeader *block = arena->pending;
+    arena->pending = NULL;
+    arena->pending_bytes = 0;
+    while (block)
+    {
+        BlockHeader *next = FREE_NEXT(block);  // free_block() reuses the link
+        free_block(arena, block);
+        block = next;
+    }
+    STAT_ADD(coalesce_passes, 1);
+}
+#endif
+
+// Function to resize an allocated block in place, returning 1 on success or 0 when the data has to move
+static int resize_block(HmmArena *arena, BlockHeader *block, size_t size)
+{
+    if (size < MIN_PAYLOAD)
+    {
+        size = MIN_PAYLOAD;  // The block must be able to hold its free-list links once it is freed
+    }
+
+    size_t old_size = BLOCK_SIZE(block);
+    if (size <= old_size)
+    {
+        split_block(arena, block, size);  // Shrink: the tail becomes a free block if it is big enough
+        STAT_ADD(bytes_freed, old_size - BLOCK_SIZE(block));
+        return 1;
+    }
+
+    // Grow: first into a free block right after it, then past the program break if it sits at the top
+    BlockHeader *next = NEXT_PHYSICAL(block);
+    int next_free = (void *)next < arena->program_break && IS_FREE(next);
+    size_t available = BLOCK_SIZE(block) + (next_free ? HEADER_SIZE + BLOCK_SIZE(next) : 0);
+    size_t extra = 0;
+
+    if (available < size)
+    {
+        if ((next_free ? next : block) != arena->last_block)
+        {
+            return 0;  // Allocated memory follows, the block cannot grow here
+        }
+
+        extra = extension_size(arena, size - available);
+        // A larger step than is missing may not fit near the end of the heap, then ask for just what is missing
+        if (extend_heap(arena, extra) == NULL && (extra == size - available || extend_heap(arena, extra = size - available) == NULL))
+        {
+            return 0;  // If there isn't enough space left, the data has to move
+        }
+    }
+
+    if (next_free)
+    {
+        remove_from_free_list(arena, next);  // Absorb the free neighbour
+    }
+    SET_BLOCK_SIZE(block, available + extra);
+
+    if ((void *)NEXT_PHYSICAL(block) < arena->program_break)
+    {
+        SET_PREV_FREE(NEXT_PHYSICAL(block), 0);  // Its new neighbour must no longer look back through a footer
+    }
+    else
+    {
+        arena->last_block = block;
+    }
+
+    split_block(arena, block, size);  // Give back whatever is not needed
+    STAT_ADD(bytes_allocated, BLOCK_SIZE(block) - old_size);
+    return 1;
+}
+
+// Function to decide how far to move the program break when the heap is short of the given number of bytes
+static size_t extension_size(HmmArena *arena, size_t needed)
+{
+#ifndef HMM_REDUCED
+    (void)arena;
+    return needed;  // The Fixed strategy grows the heap by exactly what is needed
+#else
+    // Growing geometrically keeps the number of extensions logarithmic in the heap size, while the cap
+    // tracks the heap in use so a small program never strands megabytes at the top
+    size_t cap = ALIGN(((uintptr_t)arena->program_break - (uintptr_t)arena->heap) / CHUNK_WASTE_DIVISOR);
+    if (cap > HMM_CHUNK_MAX)
+    {
+        cap = HMM_CHUNK_MAX;
+    }
+    if (cap < HMM_CHUNK_SIZE)
+    {
+        cap = HMM_CHUNK_SIZE;
+    }
+
+    size_t step = arena->growth_step < cap ? arena->growth_step : cap;
+    arena->growth_step = step * 2 < cap ? step * 2 : cap;  // The next extension moves further if demand keeps up
+    return needed < step ? step : needed;
+#endif
+}
+
+
+// Function to move the program break forward like sbrk(), returning the old break or NULL if the heap is full
+static void *extend_heap(HmmArena *arena, size_t increment)
+{
+#ifdef HMM_USE_MMAP
+    if (arena->heap == NULL && !reserve_heap())
+    {
+        return NULL;  // The address space could not be reserved
+    }
+#endif
+
+    if ((uintptr_t)arena->program_break + increment > (uintptr_t)arena->heap + arena->size)
+    {
+        return NULL;  // If there isn't enough space left, return NULL
+    }
+
+#if defined(HMM_HUGEPAGES) && !defined(HMM_USE_MMAP)
+    if (arena->os_backed && arena->zero_mark == arena->heap)
+    {
+        advise_huge_pages(arena->heap, arena->size);  // First extension of heap[]
+    }
+#endif
+
+#ifdef HMM_USE_MMAP
+    uintptr_t end = (uintptr_t)arena->program_break + increment;
+    if (arena->os_backed && end > (uintptr_t)arena->committed)
+    {
+        // Commit whole chunks so the break can move a while before the next mprotect() call
+        size_t commit = (end - (uintptr_t)arena->committed + HEAP_COMMIT_CHUNK - 1) / HEAP_COMMIT_CHUNK * HEAP_COMMIT_CHUNK;
+        if (mprotect(arena->committed, commit, PROT_READ | PROT_WRITE) != 0)
+        {
+            return NULL;  // The OS refused to back more memory
+        }
+        arena->committed = (void *)((uintptr_t)arena->committed + commit);
+    }
+#endif
+
+    void *old_break = arena->program_break;
+    arena->program_break = (void *)((uintptr_t)arena->program_break + increment);
+    if (arena->program_break > arena->zero_mark)
+    {
+        arena->zero_mark = arena->program_break;  // This memory may be written from now on
+    }
+#ifdef HMM_STATS
+    if (arena->program_break > arena->peak)
+    {
+        arena->peak = arena->program_break;
+    }
+#endif
+    STAT_ADD(heap_extensions, 1);
+    return old_break;
+}
+
+#ifdef HMM_REDUCED
+// Function to move the program break back over a large free block at the top of the heap
+static void trim_heap(HmmArena *arena)
+{
+    if (page_size == 0)
+    {
+        page_size = HEAP_PAGE_SIZE;
+    }
+
+    // The block itself stays so last_block remains valid, shrunk to one step so the next requests do not
+    // move the break straight back up
+    BlockHeader *block = arena->last_block;
+    size_t keep = arena->growth_step < MIN_PAYLOAD ? MIN_PAYLOAD : arena->growth_step;
+    uintptr_t new_break = ((uintptr_t)(block + 1) + keep + page_size - 1) & ~(page_size - 1);
+    if (new_break + HEAP_TRIM_THRESHOLD > (uintptr_t)arena->program_break)
+    {
+        return;  // Not enough to give back past the step that is kept
+    }
+
+    remove_from_free_list(arena, block);
+    SET_BLOCK_SIZE(block, new_break - (uintptr_t)(block + 1));
+    arena->program_break = (void *)new_break;
+    set_boundary_tag(arena, block);
+    add_to_free_list(arena, block);
+
+#ifdef HMM_USE_MMAP
+    uintptr_t end = (uintptr_t)arena->committed;  // Every page above the break was committed at some point
+#else
+    // Everything up to zero_mark may have been written, but the page that holds the end of heap[] may hold other statics
+    uintptr_t end = ((uintptr_t)arena->zero_mark + page_size - 1) & ~(page_size - 1);
+    if (end > (((uintptr_t)arena->heap + arena->size) & ~(page_size - 1)))
+    {
+        end = ((uintptr_t)arena->heap + arena->size) & ~(page_size - 1);
+    }
+#endif
+    release_pages(arena->program_break, (void *)end);
+#ifdef __linux__
+    if (end >= (uintptr_t)arena->zero_mark)
+    {
+        arena->zero_mark = arena->program_break;  // Released private pages read back as zero on Linux
+    }
+#endif
+
+    // Demand has dropped, so the next extension starts from a smaller step
+    arena->growth_step = arena->growth_step / 2 < HMM_CHUNK_SIZE ? HMM_CHUNK_SIZE : ALIGN(arena->growth_step / 2);
+    STAT_ADD(heap_trims, 1);
+}
+#elif defined(HMM_USE_MMAP)
+// Function to move the program break back over a large free block at the top of the heap
+static void trim_heap(HmmArena *arena)
+{
+    // The block itself stays so last_block remains valid, shrunk to the page holding its links and footer
+    BlockHeader *block = arena->last_block;
+    uintptr_t new_break = ((uintptr_t)(block + 1) + MIN_PAYLOAD + page_size - 1) & ~(page_size - 1);
+    if (new_break >= (uintptr_t)arena->program_break)
+    {
+        return;  // Nothing past the first page to give back
+    }
+
+    remove_from_free_list(arena, block);
+    SET_BLOCK_SIZE(block, new_break - (uintptr_t)(block + 1));
+    arena->program_break = (void *)new_break;
+    set_boundary_tag(arena, block);
+    add_to_free_list(arena, block);
+
+    // Every page above the break was committed at some point, drop them all; they read back as zero
+    release_pages(arena->program_break, arena->committed);
+    arena->zero_mark = arena->program_break;
+    STAT_ADD(heap_trims, 1);
+}
+#endif
+
+#if defined(HMM_USE_MMAP) || defined(HMM_REDUCED)
+// Function to give the whole pages between two addresses back to the OS, they read back as zero afterwards
+static void release_pages(void *start, void *end)
+{
+    uintptr_t first = ((uintptr_t)start + page_size - 1) & ~(page_size - 1);
+    uintptr_t last = (uintptr_t)end & ~(page_size - 1);
+    if (first < last)
+    {
+        madvise((void *)first, last - first, MADV_DONTNEED);
+    }
+}
+#endif
+
+#ifdef HMM_USE_MMAP
+// Function to reserve the address space of the heap, returning 0 if the OS refuses
+static int reserve_heap(void)
+{
+    // PROT_NONE and MAP_NORESERVE: the reservation costs neither memory nor swap until it is committed
+#ifdef HMM_HUGEPAGES
+    // Reserve one huge page more than needed, then unmap the ends so the heap starts on a huge-page boundary
+    void *area = mmap(NULL, HEAP_SIZE + HUGE_PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED)
+    {
+        return 0;
+    }
+    uintptr_t aligned = ((uintptr_t)area + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    if (aligned > (uintptr_t)area)
+    {
+        munmap(area, aligned - (uintptr_t)area);
+    }
+    munmap((void *)(aligned + HEAP_SIZE), (uintptr_t)area + HUGE_PAGE_SIZE - aligned);
+    area = (void *)aligned;
+    advise_huge_pages(area, HEAP_SIZE);
+#else
+    void *area = mmap(NULL, HEAP_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED)
+    {
+        return 0;
+    }
+#endif
+
+    page_size = HEAP_PAGE_SIZE;
+#ifdef HMM_NUMA
+    // Each node gets its own part of the reservation, and each part its own free lists and program break
+    for (int node = 0; node < HMM_MAX_NODES; node++)
+    {
+        HmmArena *arena = &node_arenas[node];
+        arena->heap = (uint8_t *)area + (size_t)node * NODE_HEAP_SIZE;
+        arena->size = NODE_HEAP_SIZE;
+        arena->program_break = arena->heap;
+        arena->zero_mark = arena->heap;
+        arena->committed = arena->heap;
+        arena->os_backed = 1;
+#ifdef HMM_REDUCED
+        arena->growth_step = HMM_CHUNK_SIZE;
+#endif
+        bind_to_node(arena->heap, NODE_HEAP_SIZE, node);
+    }
+#else
+    main_arena.heap = area;
+    main_arena.size = HEAP_SIZE;
+    main_arena.program_break = area;
+    main_arena.zero_mark = area;
+    main_arena.committed = area;
+#endif
+    return 1;
+}
+
+#ifdef HMM_NUMA
+// Function to return the NUMA node of the calling thread, asking the kernel only on the thread's first call
+static int current_node(void)
+{
+    if (thread_node < 0)
+    {
+        unsigned int cpu, node = 0;
+#ifdef SYS_getcpu
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        {
+            node = 0;  // Unknown: behave like a single-node machine
+        }
+#endif
+        thread_node = (int)(node % HMM_MAX_NODES);
+    }
+    return thread_node;
+}
+
+// Function to ask the kernel to place the pages of a range on one NUMA node
+static void bind_to_node(void *start, size_t length, int node)
+{
+#ifdef SYS_mbind
+    // MPOL_PREFERRED falls back to other nodes when this one is full; the call fails harmlessly for a node
+    // the machine does not have, and pages are then placed where they are first touched, by the thread allocating them
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, start, length, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+#else
+    (void)start;
+    (void)length;
+    (void)node;
+#endif
+}
+#endif
+
+// Function to give a huge block pages of its own, outside the heap
+static void *map_block(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);  // Not page_size: the heap may not be reserved yet
+    size_t length = (HEADER_SIZE + size + page - 1) & ~(page - 1);
+    if (length < size)
+    {
+        return NULL;  // The size overflowed
+    }
+
+    BlockHeader *block = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED)
+    {
+        STAT_ADD(failed_allocs, 1);
+        return NULL;
+    }
+
+    // The header records the whole mapping, so the block can be unmapped from its pointer alone
+    INIT_HEADER(block, length - HEADER_SIZE, 0, 0);
+    STAT_ADD(mapped_allocs, 1);
+    STAT_ADD(bytes_allocated, length - HEADER_SIZE);
+    return (void *)(block + 1);
+}
+
+// Function to give a huge block pages of its own whose payload is a multiple of alignment
+static void *map_aligned_block(size_t size, size_t alignment)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t span = HEADER_SIZE + size + alignment;  // Room to slide the payload up to the next aligned address
+    size_t length = (span + page - 1) & ~(page - 1);
+    if (span < size || length < span)
+    {
+        return NULL;  // The size overflowed
+    }
+
+    uint8_t *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        STAT_ADD(failed_allocs, 1);
+        return NULL;
+    }
+
+    // Keep only the pages from the one holding the header to the one holding the end of the payload
+    uintptr_t payload = ((uintptr_t)base + HEADER_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    uintptr_t start = (payload - HEADER_SIZE) & ~(uintptr_t)(page - 1);
+    uintptr_t end = (payload + size + page - 1) & ~(uintptr_t)(page - 1);
+    if (start > (uintptr_t)base)
+    {
+        munmap(base, start - (uintptr_t)base);
+    }
+    if (end < (uintptr_t)base + length)
+    {
+        munmap((void *)end, (uintptr_t)base + length - end);
+    }
+
+    // The header may sit after the start of its first page, unmap_block() rounds it down
+    BlockHeader *block = (BlockHeader *)payload - 1;
+    INIT_HEADER(block, end - payload, 0, 0);
+    STAT_ADD(mapped_allocs, 1);
+    STAT_ADD(bytes_allocated, end - payload);
+    return (void *)payload;
+}
+
+// Function to return a directly mapped block to the OS
+static void unmap_block(void *ptr)
+{
+    BlockHeader *block = (BlockHeader *)ptr - 1;
+    uintptr_t start = (uintptr_t)block & ~(uintptr_t)((size_t)sysconf(_SC_PAGESIZE) - 1);  // The mapping starts before the header of an aligned block
+    STAT_ADD(mapped_frees, 1);
+    STAT_ADD(bytes_freed, BLOCK_SIZE(block));
+    munmap((void *)start, (uintptr_t)ptr + BLOCK_SIZE(block) - start);
+}
+
+// Function to resize a directly mapped block, moving its pages rather than copying them where possible
+static void *remap_block(void *ptr, size_t size)
+{
+    BlockHeader *block = (BlockHeader *)ptr - 1;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t offset = (uintptr_t)block & (page - 1);  // Where the header of an aligned block sits in its first page
+    size_t old_length = offset + HEADER_SIZE + BLOCK_SIZE(block);
+    size_t length = (offset + HEADER_SIZE + size + page - 1) & ~(page - 1);
+    if (length < size)
+    {
+        return NULL;  // The size overflowed
+    }
+    if (length == old_length)
+    {
+        return ptr;  // The same number of pages
+    }
+
+#ifdef MREMAP_MAYMOVE
+    uint8_t *new_start = mremap((uint8_t *)block - offset, old_length, length, MREMAP_MAYMOVE);
+    if (new_start == MAP_FAILED)
+    {
+        return NULL;  // The original block is left untouched
+    }
+    BlockHeader *new_block = (BlockHeader *)(new_start + offset);
+    SET_BLOCK_SIZE(new_block, length - offset - HEADER_SIZE);
+    STAT_ADD(bytes_allocated, length);
+    STAT_ADD(bytes_freed, old_length);
+    return (void *)(new_block + 1);
+#else
+    // No mremap() on this system: map new pages and copy
+    void *new_ptr = map_block(size);
+    if (new_ptr == NULL)
+    {
+        return NULL;  // The original block is left untouched
+    }
+    memcpy(new_ptr, ptr, size < BLOCK_SIZE(block) ? size : BLOCK_SIZE(block));
+    unmap_block(ptr);
+    return new_ptr;
+#endif
+}
+#endif
+
+// Function to map a block size to the index of its size-class bin
+static size_t bin_index(size_t size)
+{
+    if (size <= SMALL_BIN_MAX)
+    {
+        return size / sizeof(size_t) - 1;  // Exact-size bins: 8 -> 0, 16 -> 1, ..., 256 -> 31
+    }
+
+#ifdef HMM_TLSF
+    // First level: the power of two; second level: the TLSF_SL_LOG2 bits below the leading one
+    // 264..271 -> 32, 272..287 -> 33, ..., 496..511 -> 47, 512..543 -> 48, ...
+    size_t first = FLOOR_LOG2(size);
+    size_t second = (size >> (first - TLSF_SL_LOG2)) - TLSF_SL_COUNT;
+    return NUM_SMALL_BINS + (first - FLOOR_LOG2(SMALL_BIN_MAX)) * TLSF_SL_COUNT + second;
+#else
+    // Power-of-two bins: 264..511 -> 32, 512..1023 -> 33, ...
+    size_t index = NUM_SMALL_BINS + FLOOR_LOG2(size) - FLOOR_LOG2(SMALL_BIN_MAX);
+    return index < NUM_BINS ? index : NUM_BINS - 1;  // The last bin takes everything bigger
+#endif
+}
+
+#ifdef HMM_TLSF
+// Function to return the first bin whose blocks are all at least the given size
+static size_t tlsf_search_index(size_t size)
+{
+    if (size > SMALL_BIN_MAX)
+    {
+        size_t rounded = size + ((size_t)1 << (FLOOR_LOG2(size) - TLSF_SL_LOG2)) - 1;  // Round up to the start of the next bin
+        if (rounded < size)
+        {
+            return NUM_BINS - 1;  // No block can be this large
+        }
+        size = rounded;
+    }
+    return bin_index(size);
+}
+
+// Function to return the first non-empty bin at or after the given one, or NUM_BINS if there is none
+static size_t tlsf_find_bin(HmmArena *arena, size_t index)
+{
+    size_t word = index / 64;
+    uint64_t bits = arena->bin_bitmap[word] & (~(uint64_t)0 << (index % 64));
+    if (bits == 0)
+    {
+        uint64_t words = word + 1 < BITMAP_WORDS ? arena->bin_summary & (~(uint64_t)0 << (word + 1)) : 0;
+        if (words == 0)
+        {
+            return NUM_BINS;
+        }
+        word = (size_t)__builtin_ctzll(words);
+        bits = arena->bin_bitmap[word];
+    }
+    return word * 64 + (size_t)__builtin_ctzll(bits);
+}
+#endif
+
+// Function to find a free block that can accommodate the requested size
+static BlockHeader *find_free_block(HmmArena *arena, size_t size)
+{
+    size_t index = bin_index(size);
+    BlockHeader *block = NULL;
+    STAT_ADD(searches, 1);
+
+#ifdef HMM_TLSF
+    // Every block from the first bin above the request's own fits, so no list is walked
+    index = tlsf_find_bin(arena, tlsf_search_index(size));
+    if (index < NUM_BINS)
+    {
+        block = arena->free_lists[index];
+    }
+#else
+    if (index < NUM_SMALL_BINS)
+    {
+        block = arena->free_lists[index];  // Every block in an exact-size bin fits
+    }
+    else
+    {
+#ifdef HMM_BEST_FIT
+        block = tree_find(arena, size);  // The smallest large block that fits, in O(log n)
+#else
+        // Blocks in a power-of-two bin may be smaller than the request, so pick the best fit
+        for (BlockHeader *current = arena->free_lists[index]; current; current = FREE_NEXT(current))
+        {
+            STAT_ADD(search_steps, 1);
+            if (BLOCK_SIZE(current) >= size && (block == NULL || BLOCK_SIZE(current) < BLOCK_SIZE(block)))
+            {
+                block = current;
+                if (BLOCK_SIZE(current) == size)
+                {
+                    break;  // An exact fit cannot be beaten
+                }
+            }
+        }
+#endif
+    }
+
+    if (block == NULL && index + 1 < NUM_BINS)
+    {
+        // Any block in a higher non-empty bin is big enough, so take the head of the nearest one
+        uint64_t larger = arena->bin_bitmap & (~(uint64_t)0 << (index + 1));
+        if (larger)
+        {
+            block = arena->free_lists[__builtin_ctzll(larger)];
+        }
+    }
+
+#ifdef HMM_BEST_FIT
+    if (block == NULL && index < NUM_SMALL_BINS)
+    {
+        block = tree_find(arena, size);  // No small block fits, so take the smallest large one
+    }
+#endif
+#endif
+
+    if (block)
+    {
+        remove_from_free_list(arena, block);  // Remove the block from its free list
+        split_block(arena, block, size);  // Split the block if necessary
+        return block;
+    }
+
+#ifdef HMM_LAZY_COALESCE
+    if (arena->pending)
+    {
+        // Nothing in the bins fits: merge the pending frees and search again before growing the heap
+        coalesce_pending(arena);
+        return find_free_block(arena, size);
+    }
+#endif
+
+    // If no suitable block is found, extend the heap by moving the program break, by a whole step in the Reduced strategy
+    BlockHeader *new_block;
+    if (arena->last_block && IS_FREE(arena->last_block))
+    {
+        // The free block at the top of the heap is too small, so grow it in place instead of stranding it
+        size_t extra = size - BLOCK_SIZE(arena->last_block);
+        size_t chunk_size = extension_size(arena, extra);
+
+        // Move the program break forward by the step, or by just what is missing near the end of the heap
+        if (extend_heap(arena, chunk_size) == NULL && (chunk_size == extra || extend_heap(arena, chunk_size = extra) == NULL))
+        {
+            return NULL;  // If there isn't enough space left, return NULL
+        }
+
+        remove_from_free_list(arena, arena->last_block);
+        new_block = arena->last_block;
+        SET_BLOCK_SIZE(new_block, BLOCK_SIZE(new_block) + chunk_size);
+        SET_FREE(new_block, 0);
+    }
+    else
+    {
+        size_t chunk_size = extension_size(arena, size + HEADER_SIZE);
+
+        // Create a new block at the current program break position, moving the break past it and its header
+        new_block = (BlockHeader *)extend_heap(arena, chunk_size);
+        if (new_block == NULL && (chunk_size == size + HEADER_SIZE || (new_block = (BlockHeader *)extend_heap(arena, chunk_size = size + HEADER_SIZE)) == NULL))
+        {
+            return NULL;  // If there isn't enough space left, return NULL
+        }
+        INIT_HEADER(new_block, chunk_size - HEADER_SIZE, 0, 0);  // Allocated; a free top block would have been grown instead
+        arena->last_block = new_block;
+    }
+
+    // A step larger than the request leaves room at the top, which goes to the free lists
+    split_block(arena, new_block, size);
+    return new_block;
+}
+
+// Function to split a block into two if the requested size is smaller than the block size
+static void split_block(HmmArena *arena, BlockHeader *block, size_t size)
+{
+    if (BLOCK_SIZE(block) >= size + HEADER_SIZE + MIN_PAYLOAD)
+    {
+        // Calculate the address of the new block that will be created by the split
+        BlockHeader *new_block = (BlockHeader *)((uintptr_t)block + HEADER_SIZE + size);
+        
+        
+        
+        SET_BLOCK_SIZE(new_block, BLOCK_SIZE(block) - size - HEADER_SIZE);  // Adjust the size of the new block
+        SET_FREE(new_block, 1);  // Mark the new block as free
+
+
+        SET_PREV_FREE(new_block, 0);  // The original block is about to be handed out
+
+        SET_BLOCK_SIZE(block, size);  // Adjust the size of the original block
+
+        // When shrinking an allocated block the block after it may be free, so merge the remainder forward
+        new_block = merge_free_blocks(arena, new_block);
+        STAT_ADD(splits, 1);
+
+        // Hand the remainder to the bin of its own size class
+        add_to_free_list(arena, new_block);
+    }
+}
+
+// Function to add a block to the free list of its size class
+static void add_to_free_list(HmmArena *arena, BlockHeader *block)
+{
+#ifdef HMM_BEST_FIT
+    if (BLOCK_SIZE(block) > SMALL_BIN_MAX)
+    {
+        tree_insert(arena, block);
+        return;
+    }
+#endif
+
+    size_t index = bin_index(BLOCK_SIZE(block));
+
+    SET_FREE_PREV(block, NULL);
+    SET_FREE_NEXT(block, arena->free_lists[index]);  // Add the block to the beginning of its bin
+    if (arena->free_lists[index])
+    {
+        SET_FREE_PREV(arena->free_lists[index], block);
+    }
+    arena->free_lists[index] = block;
+
+#ifdef HMM_TLSF
+    arena->bin_bitmap[index / 64] |= (uint64_t)1 << (index % 64);  // The bin is now non-empty
+    arena->bin_summary |= (uint64_t)1 << (index / 64);
+#else
+    arena->bin_bitmap |= (uint64_t)1 << index;  // The bin is now non-empty
+#endif
+}
+
+// Function to unlink a block from the free list of its size class
+static void remove_from_free_list(HmmArena *arena, BlockHeader *block)
+{
+#ifdef HMM_BEST_FIT
+    if (BLOCK_SIZE(block) > SMALL_BIN_MAX)
+    {
+        tree_remove(arena, block);
+        return;
+    }
+#endif
+
+    size_t index = bin_index(BLOCK_SIZE(block));
+
+    if (FREE_PREV(block))
+    {
+        SET_FREE_NEXT(FREE_PREV(block), FREE_NEXT(block));
+    }
+    else
+    {
+        arena->free_lists[index] = FREE_NEXT(block);  // Update the bin head
+    }
+    if (FREE_NEXT(block))
+    {
+        SET_FREE_PREV(FREE_NEXT(block), FREE_PREV(block));
+    }
+
+    if (arena->free_lists[index] == NULL)
+    {
+#ifdef HMM_TLSF
+        arena->bin_bitmap[index / 64] &= ~((uint64_t)1 << (index % 64));  // The bin became empty
+        if (arena->bin_bitmap[index / 64] == 0)
+        {
+            arena->bin_summary &= ~((uint64_t)1 << (index / 64));
+        }
+#else
+        arena->bin_bitmap &= ~((uint64_t)1 << index);  // The bin became empty
+#endif
+    }
+}
+
+#ifdef HMM_BEST_FIT
+// Function to find the smallest block in the tree of at least the given size, or NULL if none is big enough
+static BlockHeader *tree_find(HmmArena *arena, size_t size)
+{
+    BlockHeader *best = NULL;
+    for (BlockHeader *node = arena->free_tree; node; )
+    {
+        STAT_ADD(search_steps, 1);
+        if (BLOCK_SIZE(node) >= size)
+        {
+            best = node;  // Fits; a smaller fit can only be on the left
+            node = TREE(node)->child[0];
+        }
+        else
+        {
+            node = TREE(node)->child[1];
+        }
+    }
+    return best;
+}
+
+#ifdef HMM_STATS
+// Function to return the block after the given one in tree order, or NULL at the end, for the statistics
+static BlockHeader *tree_next(BlockHeader *block)
+{
+    if (TREE(block)->child[1])
+    {
+        block = TREE(block)->child[1];
+        while (TREE(block)->child[0])
+        {
+            block = TREE(block)->child[0];
+        }
+        return block;
+    }
+
+    // Climb until the block is in a left subtree
+    BlockHeader *parent = TREE(block)->parent;
+    while (parent && block == TREE(parent)->child[1])
+    {
+        block = parent;
+        parent = TREE(parent)->parent;
+    }
+    return parent;
+}
+#endif
+
+// Function to add a free block to the tree, restoring the red-black properties
+static void tree_insert(HmmArena *arena, BlockHeader *block)
+{
+    BlockHeader *parent = NULL;
+    BlockHeader **link = &arena->free_tree;
+    while (*link)
+    {
+        parent = *link;
+        link = &TREE(parent)->child[!TREE_BEFORE(block, parent)];
+    }
+
+    TREE(block)->child[0] = TREE(block)->child[1] = NULL;
+    TREE(block)->parent = parent;
+    TREE(block)->red = 1;
+    *link = block;
+
+    // A red node with a red parent: recolour while the uncle is red, otherwise rotate once or twice
+    while ((parent = TREE(block)->parent) != NULL && TREE(parent)->red)
+    {
+        BlockHeader *grandparent = TREE(parent)->parent;  // Exists, because the root is black
+        int side = TREE(grandparent)->child[1] == parent;
+        BlockHeader *uncle = TREE(grandparent)->child[!side];
+
+        if (IS_RED(uncle))
+        {
+            TREE(parent)->red = 0;
+            TREE(uncle)->red = 0;
+            TREE(grandparent)->red = 1;
+            block = grandparent;
+            continue;
+        }
+
+        if (TREE(parent)->child[!side] == block)
+        {
+            tree_rotate(arena, parent, side);  // Bring the block to the outside first
+            block = parent;
+            parent = TREE(block)->parent;
+        }
+        TREE(parent)->red = 0;
+        TREE(grandparent)->red = 1;
+        tree_rotate(arena, grandparent, !side);
+    }
+    TREE(arena->free_tree)->red = 0;
+}
+
+// Function to unlink a free block from the tree, restoring the red-black properties
+static void tree_remove(HmmArena *arena, BlockHeader *block)
+{
+    BlockHeader *child;   // Node that takes the place of the one taken out
+    BlockHeader *parent;  // Its parent, kept apart because the child may be NULL
+    size_t red;           // Colour of the node taken out
+
+    if (TREE(block)->child[0] == NULL || TREE(block)->child[1] == NULL)
+    {
+        // At most one child: it takes the block's place
+        child = TREE(block)->child[TREE(block)->child[0] == NULL];
+        parent = TREE(block)->parent;
+        red = TREE(block)->red;
+        tree_replace_child(arena, parent, block, child);
+        if (child)
+        {
+            TREE(child)->parent = parent;
+        }
+    }
+    else
+    {
+        // Two children: the next block in tree order, which has no left child, takes the block's place
+        BlockHeader *next = TREE(block)->child[1];
+        while (TREE(next)->child[0])
+        {
+            next = TREE(next)->child[0];
+        }
+        red = TREE(next)->red;
+        child = TREE(next)->child[1];
+
+        if (TREE(next)->parent == block)
+        {
+            parent = next;
+        }
+        else
+        {
+            parent = TREE(next)->parent;
+            TREE(parent)->child[0] = child;
+            if (child)
+            {
+                TREE(child)->parent = parent;
+            }
+            TREE(next)->child[1] = TREE(block)->child[1];
+            TREE(TREE(next)->child[1])->parent = next;
+        }
+
+        TREE(next)->child[0] = TREE(block)->child[0];
+        TREE(TREE(next)->child[0])->parent = next;
+        TREE(next)->red = TREE(block)->red;
+        TREE(next)->parent = TREE(block)->parent;
+        tree_replace_child(arena, TREE(block)->parent, block, next);
+    }
+
+    if (red)
+    {
+        return;  // Taking out a red node keeps every path's black count
+    }
+
+    // The child's side is one black node short: move the deficit up or fix it with the sibling's subtree
+    while (child != arena->free_tree && !IS_RED(child))
+    {
+        int side = TREE(parent)->child[0] != child;
+        BlockHeader *sibling = TREE(parent)->child[!side];  // Exists, because the other side has a black node more
+
+        if (TREE(sibling)->red)
+        {
+            TREE(sibling)->red = 0;
+            TREE(parent)->red = 1;
+            tree_rotate(arena, parent, side);
+            sibling = TREE(parent)->child[!side];
+        }
+
+        if (!IS_RED(TREE(sibling)->child[0]) && !IS_RED(TREE(sibling)->child[1]))
+        {
+            TREE(sibling)->red = 1;
+            child = parent;
+            parent = TREE(child)->parent;
+            continue;
+        }
+
+        if (!IS_RED(TREE(sibling)->child[!side]))
+        {
+            TREE(TREE(sibling)->child[side])->red = 0;
+            TREE(sibling)->red = 1;
+            tree_rotate(arena, sibling, !side);
+            sibling = TREE(parent)->child[!side];
+        }
+        TREE(sibling)->red = TREE(parent)->red;
+        TREE(parent)->red = 0;
+        TREE(TREE(sibling)->child[!side])->red = 0;
+        tree_rotate(arena, parent, side);
+        child = arena->free_tree;
+    }
+    if (child)
+    {
+        TREE(child)->red = 0;
+    }
+}
+
+// Function to rotate the subtree at a block, moving the block down on the given side (0 left, 1 right)
+static void tree_rotate(HmmArena *arena, BlockHeader *block, int dir)
+{
+    BlockHeader *pivot = TREE(block)->child[!dir];
+    BlockHeader *parent = TREE(block)->parent;
+
+    TREE(block)->child[!dir] = TREE(pivot)->child[dir];
+    if (TREE(pivot)->child[dir])
+    {
+        TREE(TREE(pivot)->child[dir])->parent = block;
+    }
+    TREE(pivot)->child[dir] = block;
+    TREE(block)->parent = pivot;
+    TREE(pivot)->parent = parent;
+    tree_replace_child(arena, parent, block, pivot);
+}
+
+// Function to point a parent, or the root when it is NULL, at a new child in place of an old one
+static void tree_replace_child(HmmArena *arena, BlockHeader *parent, BlockHeader *old_child, BlockHeader *new_child)
+{
+    if (parent == NULL)
+    {
+        arena->free_tree = new_child;
+    }
+    else
+    {
+        TREE(parent)->child[TREE(parent)->child[1] == old_child] = new_child;
+    }
+}
+#endif
+
+// Function to merge a free block with its free neighbours in memory, returning the merged block
+static BlockHeader *merge_free_blocks(HmmArena *arena, BlockHeader *block)
+{
+    BlockHeader *next = NEXT_PHYSICAL(block);
+
+    // Free blocks are always merged as they appear, so each side has at most one free neighbour
+    if ((void *)next < arena->program_break && IS_FREE(next))
+    {
+        // The block after it is free, so take it out of its bin and absorb it
+        remove_from_free_list(arena, next);
+        SET_BLOCK_SIZE(block, BLOCK_SIZE(block) + BLOCK_SIZE(next) + HEADER_SIZE);  // Increase the size of the current block
+        STAT_ADD(merges, 1);
+    }
+
+    if (IS_PREV_FREE(block))
+    {
+        // The block before it is free, locate it through its footer and let it absorb this one
+        BlockHeader *prev = PREV_PHYSICAL(block);
+        remove_from_free_list(arena, prev);
+        SET_BLOCK_SIZE(prev, BLOCK_SIZE(prev) + BLOCK_SIZE(block) + HEADER_SIZE);
+        block = prev;
+        STAT_ADD(merges, 1);
+    }
+
+    if ((void *)NEXT_PHYSICAL(block) == arena->program_break)
+    {
+        arena->last_block = block;  // The merged block now ends at the program break
+    }
+
+    set_boundary_tag(arena, block);
+    return block;
+}
+
+// Function to write the footer of a free block and flag it in the header of the block after it
+static void set_boundary_tag(HmmArena *arena, BlockHeader *block)
+{
+    FOOTER(block) = BLOCK_SIZE(block);  // Copy the size into the last word of the block
+
+    BlockHeader *next = NEXT_PHYSICAL(block);
+    if ((void *)next < arena->program_break)
+    {
+        SET_PREV_FREE(next, 1);
+    }
+}
+
+
+#ifndef HMM_NUMA
+// Function to allocate an object of an aligned size up to SLAB_MAX_OBJECT from a slab of its class; with HMM_NUMA
+// small requests come from the node's blocks instead
+static void *slab_alloc(size_t size)
+{
+    size_t cls = size / sizeof(size_t) - 1;
+    Slab *slab = slab_partial[cls];
+    if (slab == NULL)
+    {
+        slab = slab_create(size);
+        if (slab == NULL)
+        {
+            return NULL;  // No room left for another slab
+        }
+    }
+
+    // Take the first free object; a partial slab always has one
+    size_t word = 0;
+    while (slab->bitmap[word] == 0)
+    {
+        word++;
+    }
+    size_t bit = (size_t)__builtin_ctzll(slab->bitmap[word]);
+    slab->bitmap[word] &= ~((uint64_t)1 << bit);
+
+    if (++slab->used == slab->capacity)
+    {
+        slab_unlink(slab);  // A full slab leaves the partial list until an object is freed
+    }
+    STAT_ADD(slab_allocs, 1);
+    STAT_ADD(bytes_allocated, slab->object_size);
+
+    return (uint8_t *)slab + SLAB_HEADER_SIZE + (word * 64 + bit) * slab->object_size;
+}
+#endif
+
+// Function to return an object to its slab, found by masking the object's address
+static void slab_free(void *ptr)
+{
+    Slab *slab = SLAB_FROM_POINTER(ptr);
+    size_t cls = slab->object_size / sizeof(size_t) - 1;
+    size_t index = ((uint8_t *)ptr - ((uint8_t *)slab + SLAB_HEADER_SIZE)) / slab->object_size;
+
+    if (slab->used == slab->capacity)
+    {
+        // The slab was full, put it back on the partial list of its class
+        slab->prev = NULL;
+        slab->next = slab_partial[cls];
+        if (slab_partial[cls])
+        {
+            slab_partial[cls]->prev = slab;
+        }
+        slab_partial[cls] = slab;
+    }
+
+    slab->bitmap[index / 64] |= (uint64_t)1 << (index % 64);
+    STAT_ADD(slab_frees, 1);
+    STAT_ADD(bytes_freed, slab->object_size);
+
+    if (--slab->used == 0)
+    {
+        // The slab is empty, hand it to the pool so any class can reuse the page
+        slab_unlink(slab);
+        slab->next = slab_empty;
+        slab_empty = slab;
+    }
+}
+
+#ifndef HMM_NUMA
+// Function to set up a new slab for objects of the given size and add it to the partial list of its class
+static Slab *slab_create(size_t size)
+{
+    Slab *slab = slab_empty;
+    if (slab)
+    {
+        slab_empty = slab->next;  // Reuse an empty slab
+    }
+    else
+    {
+        if (slab_break + SLAB_SIZE > slab_area + SLAB_AREA_SIZE)
+        {
+            return NULL;  // If there isn't enough space left, return NULL
+        }
+#ifdef HMM_HUGEPAGES
+        if (slab_break == slab_area)
+        {
+            advise_huge_pages(slab_area, SLAB_AREA_SIZE);  // First slab
+        }
+#endif
+        slab = (Slab *)slab_break;  // Carve a fresh slab
+        slab_break += SLAB_SIZE;
+    }
+
+    slab->object_size = size;
+    slab->capacity = (uint32_t)((SLAB_SIZE - SLAB_HEADER_SIZE) / size);
+    slab->used = 0;
+
+    // Mark the first capacity objects as free
+    for (size_t word = 0; word < SLAB_BITMAP_WORDS; word++)
+    {
+        size_t first = word * 64;
+        if (first + 64 <= slab->capacity)
+        {
+            slab->bitmap[word] = ~(uint64_t)0;
+        }
+        else if (first < slab->capacity)
+        {
+            slab->bitmap[word] = ((uint64_t)1 << (slab->capacity - first)) - 1;
+        }
+        else
+        {
+            slab->bitmap[word] = 0;
+        }
+    }
+
+    size_t cls = size / sizeof(size_t) - 1;
+    slab->prev = NULL;
+    slab->next = slab_partial[cls];
+    if (slab_partial[cls])
+    {
+        slab_partial[cls]->prev = slab;
+    }
+    slab_partial[cls] = slab;
+    return slab;
+}
+#endif
+
+// Function to remove a slab from the partial list of its class
+static void slab_unlink(Slab *slab)
+{
+    size_t cls = slab->object_size / sizeof(size_t) - 1;
+
+    if (slab->prev)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        slab_partial[cls] = slab->next;
+    }
+    if (slab->next)
+    {
+        slab->next->prev = slab->prev;
+    }
+}
+
+#ifdef HMM_THREAD_SAFE
+// Function to get the calling thread's cache, installing its thread-exit flush on first use
+static ThreadCache *get_thread_cache(void)
+{
+    ThreadCache *cache = &tcache;
+    if (!cache->registered)
+    {
+        pthread_once(&tcache_key_once, tcache_create_key);
+        pthread_setspecific(tcache_key, cache);
+        cache->registered = 1;
+    }
+    return cache;
+}
+
+// Function to allocate a small object from the thread cache, refilling it when empty
+static void *tcache_alloc(size_t size)
+{
+    ThreadCache *cache = get_thread_cache();
+    size_t index = bin_index(size);
+
+    if (cache->bins[index] == NULL)
+    {
+        tcache_adopt_remote(cache, index);  // No lock needed
+    }
+
+    if (cache->bins[index] == NULL)
+    {
+        // Refill a whole batch under a single lock acquisition
+        STAT_ADD(tcache_refills, 1);
+        pthread_mutex_lock(&heap_lock);
+        for (unsigned int i = 0; i < TCACHE_BATCH; i++)
+        {
+            void *ptr = heap_alloc(size);
+            if (ptr == NULL)
+            {
+                break;  // The heap is exhausted, keep whatever was carved so far
+            }
+            NEXT_CACHED(ptr) = cache->bins[index];
+            cache->bins[index] = ptr;
+            cache->count[index]++;
+        }
+        unlock_heap();
+
+        if (cache->bins[index] == NULL)
+        {
+            return NULL;  // If nothing could be carved, return NULL
+        }
+    }
+
+    // Pop the most recently cached object, it is the most likely to still be in the CPU cache
+    STAT_ADD(tcache_hits, 1);
+    void *ptr = cache->bins[index];
+    cache->bins[index] = NEXT_CACHED(ptr);
+    cache->count[index]--;
+    return ptr;
+}
+
+// Function to keep a freed small object in the thread cache, passing it on lock-free when the bin is full
+static void tcache_free(void *ptr, size_t size)
+{
+    ThreadCache *cache = get_thread_cache();
+    size_t index = bin_index(size);
+
+    if (cache->count[index] >= TCACHE_LIMIT)
+    {
+        // Typically a consumer freeing a producer's objects: the producer picks them up on its next refill
+        lockfree_push(&REMOTE_FREES(index), ptr);
+        STAT_ADD(remote_frees, 1);
+        return;
+    }
+
+    NEXT_CACHED(ptr) = cache->bins[index];
+    cache->bins[index] = ptr;
+    cache->count[index]++;
+}
+
+// Function to hand up to count cached objects of one size class back to the shared heap
+static void tcache_drain(ThreadCache *cache, size_t index, unsigned int count)
+{
+    pthread_mutex_lock(&heap_lock);
+    while (count-- && cache->bins[index])
+    {
+        void *ptr = cache->bins[index];
+        cache->bins[index] = NEXT_CACHED(ptr);
+        cache->count[index]--;
+        heap_free(ptr);
+    }
+    unlock_heap();
+}
+
+// Function to move every object other threads pushed onto a size class into the cache with one atomic exchange
+static void tcache_adopt_remote(ThreadCache *cache, size_t index)
+{
+    void *ptr = atomic_exchange_explicit(&REMOTE_FREES(index), NULL, memory_order_acquire);
+    while (ptr)
+    {
+        void *next = NEXT_CACHED(ptr);
+        NEXT_CACHED(ptr) = cache->bins[index];
+        cache->bins[index] = ptr;
+        cache->count[index]++;
+        ptr = next;
+    }
+}
+
+// Function run at thread exit to return every cached object, and the pending remote frees, to the shared heap
+static void tcache_flush(void *cache)
+{
+    for (size_t index = 0; index < NUM_SMALL_BINS; index++)
+    {
+        tcache_adopt_remote((ThreadCache *)cache, index);
+        tcache_drain((ThreadCache *)cache, index, (unsigned int)-1);
+    }
+    ((ThreadCache *)cache)->registered = 0;
+}
+
+// Function to create the key that triggers tcache_flush at thread exit
+static void tcache_create_key(void)
+{
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
+// Function to push an object onto a Treiber stack; popping is always a whole-stack exchange, so there is no ABA problem
+static void lockfree_push(_Atomic(void *) *stack, void *ptr)
+{
+    void *head = atomic_load_explicit(stack, memory_order_relaxed);
+    do
+    {
+        NEXT_CACHED(ptr) = head;
+    } while (!atomic_compare_exchange_weak_explicit(stack, &head, ptr, memory_order_release, memory_order_relaxed));
+}
+
+// Function to release heap_lock, first applying the frees other threads deferred while it was held
+static void unlock_heap(void)
+{
+    do
+    {
+        void *ptr = atomic_exchange_explicit(&deferred_frees, NULL, memory_order_acquire);
+        while (ptr)
+        {
+            void *next = NEXT_CACHED(ptr);
+            heap_free(ptr);
+            ptr = next;
+        }
+        pthread_mutex_unlock(&heap_lock);
+
+        // A free may have been deferred after the exchange, pick it up unless another thread now holds the lock
+    } while (atomic_load_explicit(&deferred_frees, memory_order_relaxed) && pthread_mutex_trylock(&heap_lock) == 0);
+}
+#endif
+
+#ifdef HMM_STATS
+#define STAT_SUM(name) stats->name += (size_t)atomic_load_explicit(&thread->name, memory_order_relaxed);
+#define STAT_COPY(name) stats->name = thread_stats.name;
+#define STAT_RETIRE(name) stats_retired.name += (size_t)atomic_load_explicit(&thread->name, memory_order_relaxed);
+
+// Function to fill a snapshot of the counters and of the heap's current state
+void HmmStats(HmmStatistics *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&stats_lock);
+    *stats = stats_retired;
+    for (ThreadStats *thread = stats_threads; thread; thread = thread->next)
+    {
+        HMM_STAT_COUNTERS(STAT_SUM)
+    }
+    pthread_mutex_unlock(&stats_lock);
+    pthread_mutex_lock(&heap_lock);
+#else
+    HMM_STAT_COUNTERS(STAT_COPY)
+#endif
+
+    stats->in_use_bytes = stats->bytes_allocated - stats->bytes_freed;
+    stats->heap_size = HEAP_SIZE;
+#ifdef HMM_NUMA
+    for (int node = 0; node < HMM_MAX_NODES; node++)
+    {
+        stats_add_arena(stats, &node_arenas[node]);
+    }
+#else
+    stats_add_arena(stats, &main_arena);
+#endif
+
+    stats->slabs = (size_t)(slab_break - slab_area) / SLAB_SIZE;
+    for (Slab *slab = slab_empty; slab; slab = slab->next)
+    {
+        stats->empty_slabs++;
+    }
+
+#ifdef HMM_THREAD_SAFE
+    unlock_heap();
+#endif
+}
+
+// Function to print every block between the start of the heap and the program break, then the slabs in use
+void HmmDumpHeap(FILE *out)
+{
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&heap_lock);
+#endif
+
+#ifdef HMM_NUMA
+    for (int node = 0; node < HMM_MAX_NODES; node++)
+    {
+        if (node_arenas[node].program_break != node_arenas[node].heap)
+        {
+            fprintf(out, "node %d: ", node);
+            dump_arena(out, &node_arenas[node]);
+        }
+    }
+#else
+    dump_arena(out, &main_arena);
+#endif
+
+    for (uint8_t *page = slab_area; page < slab_break; page += SLAB_SIZE)
+    {
+        Slab *slab = (Slab *)page;
+        if (slab->used)
+        {
+            fprintf(out, "  slab +%-7zu %3zu-byte objects, %u of %u used\n", (size_t)(page - slab_area),
+                    slab->object_size, slab->used, slab->capacity);
+        }
+    }
+
+#ifdef HMM_THREAD_SAFE
+    unlock_heap();
+#endif
+}
+
+// Function to add the program break and the free blocks of one arena to a snapshot
+static void stats_add_arena(HmmStatistics *stats, HmmArena *arena)
+{
+    stats->heap_used += (size_t)((uintptr_t)arena->program_break - (uintptr_t)arena->heap);
+    stats->heap_peak += arena->peak ? (size_t)((uintptr_t)arena->peak - (uintptr_t)arena->heap) : 0;
+#ifdef HMM_LAZY_COALESCE
+    stats->pending_bytes += arena->pending_bytes;
+#endif
+
+    for (size_t index = 0; index < NUM_BINS; index++)
+    {
+        for (BlockHeader *block = arena->free_lists[index]; block; block = FREE_NEXT(block))
+        {
+            stats->free_blocks++;
+            stats->free_bytes += BLOCK_SIZE(block);
+            if (BLOCK_SIZE(block) > stats->largest_free_block)
+            {
+                stats->largest_free_block = BLOCK_SIZE(block);
+            }
+        }
+    }
+#ifdef HMM_BEST_FIT
+    for (BlockHeader *block = tree_find(arena, 0); block; block = tree_next(block))
+    {
+        stats->free_blocks++;
+        stats->free_bytes += BLOCK_SIZE(block);
+        if (BLOCK_SIZE(block) > stats->largest_free_block)
+        {
+            stats->largest_free_block = BLOCK_SIZE(block);
+        }
+    }
+#endif
+}
+
+// Function to print every block between the start of an arena and its program break
+static void dump_arena(FILE *out, HmmArena *arena)
+{
+    fprintf(out, "heap %p, program break at +%zu of %zu bytes\n", (void *)arena->heap,
+            (size_t)((uintptr_t)arena->program_break - (uintptr_t)arena->heap), arena->size);
+    for (BlockHeader *block = (BlockHeader *)arena->heap; (void *)block < arena->program_break; block = NEXT_PHYSICAL(block))
+    {
+        fprintf(out, "  +%-12zu %12zu  %s%s%s\n", (size_t)((uintptr_t)block - (uintptr_t)arena->heap), BLOCK_SIZE(block),
+                IS_FREE(block) ? "free" : "used", IS_PREV_FREE(block) ? ", prev free" : "",
+                block == arena->last_block ? ", last" : "");
+    }
+}
+
+#ifdef HMM_THREAD_SAFE
+// Function to return the counters of the calling thread, adding them to stats_threads on first use
+static ThreadStats *get_thread_stats(void)
+{
+    ThreadStats *thread = &thread_stats;
+    if (!thread->registered)
+    {
+        pthread_once(&stats_key_once, stats_create_key);
+        pthread_mutex_lock(&stats_lock);
+        thread->next = stats_threads;
+        stats_threads = thread;
+        pthread_mutex_unlock(&stats_lock);
+        pthread_setspecific(stats_key, thread);
+        thread->registered = 1;
+    }
+    return thread;
+}
+
+// Function to fold the counters of an exiting thread into stats_retired
+static void stats_retire(void *stats)
+{
+    ThreadStats *thread = stats;
+    pthread_mutex_lock(&stats_lock);
+    HMM_STAT_COUNTERS(STAT_RETIRE)
+    for (ThreadStats **link = &stats_threads; *link; link = &(*link)->next)
+    {
+        if (*link == thread)
+        {
+            *link = thread->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    // A later thread-exit destructor may count again and register the thread anew
+    memset(thread, 0, sizeof(*thread));
+}
+
+// Function to create the key whose destructor retires a thread's counters
+static void stats_create_key(void)
+{
+    pthread_key_create(&stats_key, stats_retire);
+}
+#endif
+#endif
+
+#ifdef HMM_HARDENED
+#undef HmmAlloc
+#undef HmmFree
+#undef HmmFreeSized
+#undef HmmRealloc
+#undef HmmCalloc
+#undef HmmAllocBatch
+#undef HmmFreeBatch
+#undef HmmAllocAligned
+#undef HmmUsableSize
+
+#if defined(HMM_PROFILE)
+// The profiled functions below wrap these ones
+#define HmmAlloc unprofiled_alloc
+#define HmmFree unprofiled_free
+#define HmmFreeSized unprofiled_free_sized
+#define HmmRealloc unprofiled_realloc
+#define HmmCalloc unprofiled_calloc
+#define HmmAllocBatch unprofiled_alloc_batch
+#define HmmFreeBatch unprofiled_free_batch
+#define HmmAllocAligned unprofiled_alloc_aligned
+#elif defined(HMM_TRACE)
+// The traced functions below wrap these ones
+#define HmmAlloc untraced_alloc
+#define HmmFree untraced_free
+#define HmmFreeSized untraced_free_sized
+#define HmmRealloc untraced_realloc
+#define HmmCalloc untraced_calloc
+#define HmmAllocBatch untraced_alloc_batch
+#define HmmFreeBatch untraced_free_batch
+#define HmmAllocAligned untraced_alloc_aligned
+#endif
+#undef HMM_WRAPPED
+#if defined(HMM_PROFILE) || defined(HMM_TRACE)
+#define HMM_WRAPPED static __attribute__((unused))
+#else
+#define HMM_WRAPPED
+#endif
+
+// Function to allocate memory with room for a tail canary, sealing its header
+HMM_WRAPPED void *HmmAlloc(size_t size)
+{
+    if (size == 0 || size > SIZE_MAX - GUARD_SIZE)
+    {
+        return NULL;  // Nothing to allocate, or no room for the canary
+    }
+    return guard_object(unguarded_alloc(size + GUARD_SIZE));
+}
+
+// Function to check an object's seal and canary, then hold it in the quarantine
+HMM_WRAPPED void HmmFree(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;  // If the pointer is NULL, there is nothing to free
+    }
+    guard_release(ptr, 0);
+}
+
+// Function to check an object and the size it is freed with, then hold it in the quarantine
+HMM_WRAPPED void HmmFreeSized(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    guard_release(ptr, size == 0 ? 0 : size <= SIZE_MAX - GUARD_SIZE ? size + GUARD_SIZE : SIZE_MAX);
+}
+
+// Function to check an object, resize it and guard the result
+HMM_WRAPPED void *HmmRealloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return HmmAlloc(size);  // Nothing to resize, behave like HmmAlloc
+    }
+    if (size == 0)
+    {
+        HmmFree(ptr);  // Resizing to nothing frees the block
+        return NULL;
+    }
+    if (size > SIZE_MAX - GUARD_SIZE)
+    {
+        return NULL;  // No room for the canary, the original block is left untouched
+    }
+
+    // Marked freed up front: once it has moved, the old block may already belong to another thread
+    size_t usable = guard_check(ptr, 0);
+    if (!IS_SLAB_POINTER(ptr))
+    {
+        ((BlockHeader *)ptr - 1)->check ^= GUARD_FREED;
+    }
+    GUARD_WORD(ptr, usable) ^= GUARD_FREED;
+
+    void *new_ptr = unguarded_realloc(ptr, size + GUARD_SIZE);
+    if (new_ptr == NULL)
+    {
+        guard_object(ptr);  // The original block is left untouched, and still handed out
+        return NULL;
+    }
+    return guard_object(new_ptr);
+}
+
+// Function to allocate zero-initialised memory with room for a tail canary
+HMM_WRAPPED void *HmmCalloc(size_t count, size_t size)
+{
+    if (count != 0 && size > (SIZE_MAX - GUARD_SIZE) / count)
+    {
+        return NULL;  // The total size would overflow
+    }
+    if (count * size == 0)
+    {
+        return NULL;  // If size is 0, return NULL as there's nothing to allocate
+    }
+    return guard_object(unguarded_calloc(1, count * size + GUARD_SIZE));
+}
+
+// Function to allocate a batch of guarded blocks; returns how many were allocated
+HMM_WRAPPED size_t HmmAllocBatch(size_t size, size_t count, void **out)
+{
+    if (size == 0 || size > SIZE_MAX - GUARD_SIZE)
+    {
+        return 0;  // Nothing to allocate, or no room for the canaries
+    }
+    size_t allocated = unguarded_alloc_batch(size + GUARD_SIZE, count, out);
+    for (size_t i = 0; i < allocated; i++)
+    {
+        guard_object(out[i]);
+    }
+    return allocated;
+}
+
+// Function to check a batch of objects and hold each one in the quarantine
+HMM_WRAPPED void HmmFreeBatch(void **ptrs, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (ptrs[i])
+        {
+            guard_release(ptrs[i], 0);  // They reach the heap one by one as they leave the quarantine
+        }
+    }
+}
+
+// Function to allocate aligned memory with room for a tail canary
+HMM_WRAPPED void *HmmAllocAligned(size_t size, size_t alignment)
+{
+    if (size == 0 || size > SIZE_MAX - GUARD_SIZE)
+    {
+        return NULL;  // Nothing to allocate, or no room for the canary
+    }
+    return guard_object(unguarded_alloc_aligned(size + GUARD_SIZE, alignment));
+}
+
+// Function to get the bytes usable at an allocated pointer, up to its canary
+size_t HmmUsableSize(void *ptr)
+{
+    return ptr ? unguarded_usable_size(ptr) - GUARD_SIZE : 0;
+}
+
+// Function to get the key of the seals and canaries, reading it on first use
+static uintptr_t guard_key(void)
+{
+#ifdef HMM_THREAD_SAFE
+    pthread_once(&guard_once, guard_init);
+#else
+    if (guard_secret == 0)
+    {
+        guard_init();
+    }
+#endif
+    return guard_secret;
+}
+
+// Function to derive the key from the random bytes the kernel placed on the initial stack
+static void guard_init(void)
+{
+    uintptr_t key = 0;
+    const void *random = (const void *)getauxval(AT_RANDOM);
+    if (random)
+    {
+        memcpy(&key, random, sizeof(key));
+    }
+    else
+    {
+        key = (uintptr_t)&guard_secret * GUARD_MIX;  // At least vary with the load address
+    }
+    guard_secret = key | 1;  // Never 0, which marks the key as unread
+}
+
+// Function to seal the header of a freshly allocated object and write its tail canary; returns ptr
+static void *guard_object(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return NULL;
+    }
+    if (!IS_SLAB_POINTER(ptr))
+    {
+        BlockHeader *block = (BlockHeader *)ptr - 1;
+        block->check = GUARD_SEAL(block);
+    }
+    GUARD_WORD(ptr, unguarded_usable_size(ptr)) = GUARD_TAIL(ptr);
+    return ptr;
+}
+
+// Function to check that an object is handed out (state 0) or quarantined (GUARD_FREED) and that its canary is intact,
+// aborting otherwise; returns its usable size, canary included
+static size_t guard_check(void *ptr, uintptr_t state)
+{
+    if (IS_SLAB_POINTER(ptr))
+    {
+        // No header: the pointer must be a slot of a slab in use
+        Slab *slab = SLAB_FROM_POINTER(ptr);
+        size_t offset = (uintptr_t)ptr - (uintptr_t)slab;
+        if ((uint8_t *)ptr >= slab_break || offset < SLAB_HEADER_SIZE || slab->object_size == 0 ||
+            (offset - SLAB_HEADER_SIZE) % slab->object_size != 0)
+        {
+            guard_fail("free of an invalid pointer", ptr);
+        }
+    }
+    else
+    {
+        BlockHeader *block = (BlockHeader *)ptr - 1;
+        if ((uintptr_t)ptr % HMM_ALIGNMENT != 0)
+        {
+            guard_fail("free of an invalid pointer", ptr);
+        }
+        uintptr_t seal = GUARD_SEAL(block);
+        if (block->check != (seal ^ state) || IS_FREE(block))
+        {
+            if (state)
+            {
+                guard_fail("write after free to a block header", ptr);
+            }
+            guard_fail(block->check == (seal ^ GUARD_FREED) || IS_FREE(block) ? "double free" : "free of an invalid pointer or a corrupted header", ptr);
+        }
+    }
+
+    size_t usable = unguarded_usable_size(ptr);  // Trusted now: the size is part of the seal, and a slab's is checked above
+    uintptr_t canary = GUARD_TAIL(ptr);
+    if (GUARD_WORD(ptr, usable) != (canary ^ state))
+    {
+        if (state)
+        {
+            guard_fail("write after free", ptr);
+        }
+        guard_fail(GUARD_WORD(ptr, usable) == (canary ^ GUARD_FREED) ? "double free" : "buffer overrun", ptr);
+    }
+    return usable;
+}
+
+// Function to check an object, mark it freed and quarantine it; size is what it was freed with, canary included, or 0
+static void guard_release(void *ptr, size_t size)
+{
+    size_t usable = guard_check(ptr, 0);
+    if (size > usable)
+    {
+        guard_fail("sized free with a size larger than the object", ptr);
+    }
+
+#ifdef HMM_USE_MMAP
+    if (IS_MAPPED_POINTER(ptr))
+    {
+        unguarded_free(ptr);  // Unmapped right away: a stale pointer faults, and holding huge blocks back would cost memory
+        return;
+    }
+#endif
+
+    if (!IS_SLAB_POINTER(ptr))
+    {
+        ((BlockHeader *)ptr - 1)->check ^= GUARD_FREED;
+    }
+    GUARD_WORD(ptr, usable) ^= GUARD_FREED;
+    quarantine_push(ptr, size, usable);
+}
+
+// Function to report a detected heap error and stop before it spreads
+static void guard_fail(const char *what, void *ptr)
+{
+    fprintf(stderr, "hmm: %s at %p\n", what, ptr);
+    abort();
+}
+
+// Function to add a freed object to the calling thread's quarantine, freeing the oldest ones while it is over its limits
+static void quarantine_push(void *ptr, size_t size, size_t usable)
+{
+    Quarantine *q = &quarantine;
+#ifdef HMM_THREAD_SAFE
+    if (!q->registered)
+    {
+        pthread_once(&quarantine_key_once, quarantine_create_key);
+        pthread_setspecific(quarantine_key, q);
+        q->registered = 1;
+    }
+#endif
+
+    while (q->count == HMM_QUARANTINE_SLOTS || (q->count && q->bytes + usable > HMM_QUARANTINE_BYTES))
+    {
+        quarantine_evict(q);
+    }
+    q->ptrs[(q->head + q->count) % HMM_QUARANTINE_SLOTS] = ptr;
+    q->sizes[(q->head + q->count) % HMM_QUARANTINE_SLOTS] = size;
+    q->count++;
+    q->bytes += usable;
+}
+
+// Function to take the oldest object out of a quarantine, check it was not written since its free, and really free it
+static void quarantine_evict(Quarantine *q)
+{
+    void *ptr = q->ptrs[q->head];
+    size_t size = q->sizes[q->head];
+    q->head = (q->head + 1) % HMM_QUARANTINE_SLOTS;
+    q->count--;
+    q->bytes -= guard_check(ptr, GUARD_FREED);
+    unguarded_free_sized(ptr, size);  // A size of 0 takes the path of HmmFree()
+}
+
+#ifdef HMM_THREAD_SAFE
+// Function to free every quarantined object of a thread, run when it exits
+static void quarantine_flush(void *q)
+{
+    while (((Quarantine *)q)->count)
+    {
+        quarantine_evict((Quarantine *)q);
+    }
+    ((Quarantine *)q)->registered = 0;
+}
+
+// Function to create the key that triggers quarantine_flush at thread exit
+static void quarantine_create_key(void)
+{
+    pthread_key_create(&quarantine_key, quarantine_flush);
+}
+#endif
+#endif
+
+#ifdef HMM_PROFILE
+#undef HmmAlloc
+#undef HmmFree
+#undef HmmFreeSized
+#undef HmmRealloc
+#undef HmmCalloc
+#undef HmmAllocBatch
+#undef HmmFreeBatch
+#undef HmmAllocAligned
+
+#ifdef HMM_TRACE
+// The traced functions below wrap these ones
+#define HmmAlloc untraced_alloc
+#define HmmFree untraced_free
+#define HmmFreeSized untraced_free_sized
+#define HmmRealloc untraced_realloc
+#define HmmCalloc untraced_calloc
+#define HmmAllocBatch untraced_alloc_batch
+#define HmmFreeBatch untraced_free_batch
+#define HmmAllocAligned untraced_alloc_aligned
+#endif
+#undef HMM_WRAPPED
+#ifdef HMM_TRACE
+#define HMM_WRAPPED static __attribute__((unused))
+#else
+#define HMM_WRAPPED
+#endif
+
+// Function to allocate memory, sampling the call once every HMM_PROFILE_RATE bytes on average
+HMM_WRAPPED void *HmmAlloc(size_t size)
+{
+    void *ptr = unprofiled_alloc(size);
+    if (ptr && PROFILE_DUE(size))
+    {
+        profile_sample(ptr, size);
+    }
+    return ptr;
+}
+
+// Function to free memory, dropping its sample if it has one
+HMM_WRAPPED void HmmFree(void *ptr)
+{
+    if (ptr && PROFILE_MAYBE(ptr))
+    {
+        profile_forget(ptr, NULL, NULL);  // Dropped first, another thread may get the address back right away
+    }
+    unprofiled_free(ptr);
+}
+
+// Function to free memory of a known size, dropping its sample if it has one
+HMM_WRAPPED void HmmFreeSized(void *ptr, size_t size)
+{
+    if (ptr && PROFILE_MAYBE(ptr))
+    {
+        profile_forget(ptr, NULL, NULL);
+    }
+    unprofiled_free_sized(ptr, size);
+}
+
+// Function to resize memory; the old block's sample is dropped and the new size may be sampled like an allocation
+HMM_WRAPPED void *HmmRealloc(void *ptr, size_t size)
+{
+    size_t old_size = 0;
+    size_t old_stack = 0;
+    int sampled = ptr && PROFILE_MAYBE(ptr) && profile_forget(ptr, &old_size, &old_stack);
+
+    void *new_ptr = unprofiled_realloc(ptr, size);
+    if (new_ptr == NULL)
+    {
+        if (sampled && size != 0)
+        {
+            profile_remember(ptr, old_size, old_stack);  // The original block is left untouched, and so is its sample
+        }
+        return NULL;
+    }
+    if (PROFILE_DUE(size))
+    {
+        profile_sample(new_ptr, size);
+    }
+    return new_ptr;
+}
+
+// Function to allocate zeroed memory, sampled like HmmAlloc()
+HMM_WRAPPED void *HmmCalloc(size_t count, size_t size)
+{
+    void *ptr = unprofiled_calloc(count, size);
+    if (ptr && PROFILE_DUE(count * size))  // It succeeded, so the product did not overflow
+    {
+        profile_sample(ptr, count * size);
+    }
+    return ptr;
+}
+
+// Function to allocate a batch of blocks, each one sampled like HmmAlloc()
+HMM_WRAPPED size_t HmmAllocBatch(size_t size, size_t count, void **out)
+{
+    size_t allocated = unprofiled_alloc_batch(size, count, out);
+    for (size_t i = 0; i < allocated; i++)
+    {
+        if (PROFILE_DUE(size))
+        {
+            profile_sample(out[i], size);
+        }
+    }
+    return allocated;
+}
+
+// Function to free a batch of blocks, dropping the samples among them
+HMM_WRAPPED void HmmFreeBatch(void **ptrs, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (ptrs[i] && PROFILE_MAYBE(ptrs[i]))
+        {
+            profile_forget(ptrs[i], NULL, NULL);
+        }
+    }
+    unprofiled_free_batch(ptrs, count);
+}
+
+// Function to allocate aligned memory, sampled like HmmAlloc()
+HMM_WRAPPED void *HmmAllocAligned(size_t size, size_t alignment)
+{
+    void *ptr = unprofiled_alloc_aligned(size, alignment);
+    if (ptr && PROFILE_DUE(size))
+    {
+        profile_sample(ptr, size);
+    }
+    return ptr;
+}
+
+// Function to write the sampled heap as a heap_v2 text profile, which pprof reads and scales back up by the
+// sampling rate; in-use figures come from the live samples, the bracketed ones from every sample ever taken
+int HmmProfileWrite(FILE *out)
+{
+    size_t live_count = 0;
+    size_t live_bytes = 0;
+    size_t alloc_count = 0;
+    size_t alloc_bytes = 0;
+
+    PROFILE_LOCK();
+    for (size_t index = 0; index < PROFILE_STACKS; index++)
+    {
+        live_count += profile_stacks[index].live_count;
+        live_bytes += profile_stacks[index].live_bytes;
+        alloc_count += profile_stacks[index].alloc_count;
+        alloc_bytes += profile_stacks[index].alloc_bytes;
+    }
+    fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", live_count, live_bytes, alloc_count, alloc_bytes, (size_t)HMM_PROFILE_RATE);
+    for (size_t index = 0; index < PROFILE_STACKS; index++)
+    {
+        ProfileStack *stack = &profile_stacks[index];
+        if (stack->alloc_count == 0)
+        {
+            continue;
+        }
+        fprintf(out, "%zu: %zu [%zu: %zu] @", stack->live_count, stack->live_bytes, stack->alloc_count, stack->alloc_bytes);
+        for (int frame = 0; frame < stack->depth; frame++)
+        {
+            fprintf(out, " 0x%zx", (size_t)(uintptr_t)stack->frames[frame]);
+        }
+        fputc('\n', out);
+    }
+    PROFILE_UNLOCK();
+
+    // pprof maps the addresses back to the program and its libraries through these
+    fputs("\nMAPPED_LIBRARIES:\n", out);
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps)
+    {
+        char line[512];
+        while (fgets(line, sizeof(line), maps))
+        {
+            fputs(line, out);
+        }
+        fclose(maps);
+    }
+    return ferror(out) ? -1 : 0;
+}
+
+// Function to record the call stack of a sampled allocation and draw the distance to the next sample
+static void profile_sample(void *ptr, size_t size)
+{
+    int first = profile_random == 0;
+    profile_countdown = profile_interval();
+    if (first || profile_busy)
+    {
+        return;  // The thread's first allocation only starts its count, and backtrace() may allocate
+    }
+
+    profile_busy = 1;
+    void *frames[HMM_PROFILE_DEPTH + PROFILE_SKIP];
+    int depth = backtrace(frames, HMM_PROFILE_DEPTH + PROFILE_SKIP) - PROFILE_SKIP;  // Taken before the lock, it may allocate
+    if (depth > 0)
+    {
+        PROFILE_LOCK();
+        size_t stack = profile_find_stack(frames + PROFILE_SKIP, depth);
+        if (stack != SIZE_MAX && profile_live_count < PROFILE_LIVE / 4 * 3)  // Otherwise the tables are full and the sample is lost
+        {
+            profile_stacks[stack].alloc_count++;
+            profile_stacks[stack].alloc_bytes += size;
+            profile_remember(ptr, size, stack);
+        }
+        PROFILE_UNLOCK();
+    }
+    profile_busy = 0;
+}
+
+// Function to drop the sample of a block if it has one, returning whether it had and, if asked, its size and stack
+static int profile_forget(void *ptr, size_t *size, size_t *stack)
+{
+    size_t mask = PROFILE_LIVE - 1;
+    int found = 0;
+
+    PROFILE_LOCK();
+    size_t index = PROFILE_HASH(ptr, PROFILE_LIVE);
+    while (profile_live[index].ptr && profile_live[index].ptr != ptr)
+    {
+        index = (index + 1) & mask;
+    }
+    if (profile_live[index].ptr)
+    {
+        ProfileBlock *block = &profile_live[index];
+        profile_stacks[block->stack].live_count--;
+        profile_stacks[block->stack].live_bytes -= block->size;
+        if (size)
+        {
+            *size = block->size;
+            *stack = block->stack;
+        }
+
+        size_t filter = PROFILE_HASH(ptr, PROFILE_FILTER);
+        if (FILTER_LOAD(filter) != UINT8_MAX)
+        {
+            FILTER_STORE(filter, FILTER_LOAD(filter) - 1);  // A saturated counter stays set for good
+        }
+
+        // Shift back the blocks that probed past this slot, so no search stops early at the hole
+        size_t hole = index;
+        for (size_t next = (hole + 1) & mask; profile_live[next].ptr; next = (next + 1) & mask)
+        {
+            size_t home = PROFILE_HASH(profile_live[next].ptr, PROFILE_LIVE);
+            if (((next - home) & mask) >= ((next - hole) & mask))
+            {
+                profile_live[hole] = profile_live[next];
+                hole = next;
+            }
+        }
+        profile_live[hole].ptr = NULL;
+        profile_live_count--;
+        found = 1;
+    }
+    PROFILE_UNLOCK();
+    return found;
+}
+
+// Function to add a live sampled block to the table, counting it in its stack and in the free filter
+static void profile_remember(void *ptr, size_t size, size_t stack)
+{
+    PROFILE_LOCK();
+    size_t index = PROFILE_HASH(ptr, PROFILE_LIVE);
+    while (profile_live[index].ptr)
+    {
+        index = (index + 1) & (PROFILE_LIVE - 1);  // Never full: profile_sample() stops at three quarters
+    }
+    profile_live[index].ptr = ptr;
+    profile_live[index].size = size;
+    profile_live[index].stack = stack;
+    profile_live_count++;
+    profile_stacks[stack].live_count++;
+    profile_stacks[stack].live_bytes += size;
+
+    size_t filter = PROFILE_HASH(ptr, PROFILE_FILTER);
+    if (FILTER_LOAD(filter) != UINT8_MAX)
+    {
+        FILTER_STORE(filter, FILTER_LOAD(filter) + 1);
+    }
+    PROFILE_UNLOCK();
+}
+
+// Function to find the slot of a call stack, adding it if it is new; returns SIZE_MAX once the table is nearly full
+static size_t profile_find_stack(void **frames, int depth)
+{
+    uint64_t hash = (uint64_t)depth;
+    for (int frame = 0; frame < depth; frame++)
+    {
+        hash = (hash ^ (uint64_t)(uintptr_t)frames[frame]) * PROFILE_MIX;
+    }
+
+    size_t index = (size_t)(hash >> 40) & (PROFILE_STACKS - 1);
+    while (profile_stacks[index].depth)
+    {
+        if (profile_stacks[index].depth == depth && memcmp(profile_stacks[index].frames, frames, depth * sizeof(void *)) == 0)
+        {
+            return index;
+        }
+        index = (index + 1) & (PROFILE_STACKS - 1);
+    }
+    if (profile_stack_count >= PROFILE_STACKS / 8 * 7)
+    {
+        return SIZE_MAX;
+    }
+    memcpy(profile_stacks[index].frames, frames, depth * sizeof(void *));
+    profile_stacks[index].depth = depth;
+    profile_stack_count++;
+    return index;
+}
+
+// Function to draw the bytes until the next sample from an exponential distribution of mean HMM_PROFILE_RATE,
+// which makes sampling a Poisson process as pprof assumes when it scales the profile back up
+static intptr_t profile_interval(void)
+{
+    if (profile_random == 0)
+    {
+        profile_random = ((uint64_t)(uintptr_t)&profile_random * PROFILE_MIX) | 1;  // Thread-local, so every thread gets its own sequence
+    }
+    // xorshift64*, then a uniform u in (0, 1]
+    profile_random ^= profile_random >> 12;
+    profile_random ^= profile_random << 25;
+    profile_random ^= profile_random >> 27;
+    double u = (double)(((profile_random * 2685821657736338717ULL) >> 11) + 1) * (1.0 / 9007199254740992.0);
+
+    // ln(u) from the exponent of the double and the series of ln(m) = 2 atanh((m - 1) / (m + 1)) for its mantissa m,
+    // which is within 1e-5 for m in [1, 2), so no libm is needed
+    union { double d; uint64_t bits; } value = { u };
+    int exponent = (int)((value.bits >> 52) & 0x7ff) - 1023;
+    value.bits = (value.bits & ((1ULL << 52) - 1)) | (1023ULL << 52);
+    double t = (value.d - 1.0) / (value.d + 1.0);
+    double t2 = t * t;
+    double ln_u = exponent * 0.6931471805599453 + 2.0 * t * (1.0 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7))));
+
+    return (intptr_t)(-ln_u * HMM_PROFILE_RATE) + 1;
+}
+
+#ifdef HMM_THREAD_SAFE
+// Function to set up profile_lock as a recursive mutex
+static void profile_init(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&profile_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+#endif
+#endif
+
+#ifdef HMM_TRACE
+#undef HmmAlloc
+#undef HmmFree
+#undef HmmFreeSized
+#undef HmmRealloc
+#undef HmmCalloc
+#undef HmmAllocBatch
+#undef HmmFreeBatch
+#undef HmmAllocAligned
+
+// Function to allocate memory and record the call in the trace
+void *HmmAlloc(size_t size)
+{
+    void *ptr = untraced_alloc(size);
+    trace_record(TRACE_ALLOC, ptr, NULL, size);
+    return ptr;
+}
+
+// Function to free memory and record the call in the trace
+void HmmFree(void *ptr)
+{
+    if (ptr)
+    {
+        trace_record(TRACE_FREE, ptr, NULL, 0);  // Recorded first, another thread may get the address back right away
+    }
+    untraced_free(ptr);
+}
+
+// Function to free memory of a known size and record the call in the trace
+void HmmFreeSized(void *ptr, size_t size)
+{
+    if (ptr)
+    {
+        trace_record(TRACE_FREE, ptr, NULL, 0);
+    }
+    untraced_free_sized(ptr, size);
+}
+
+// Function to resize memory and record the call in the trace
+void *HmmRealloc(void *ptr, size_t size)
+{
+#ifdef HMM_THREAD_SAFE
+    if (trace_busy)
+    {
+        return untraced_realloc(ptr, size);
+    }
+
+    // The old block is freed inside, so hold other records back until this one is written
+    trace_busy = 1;
+    pthread_mutex_lock(&trace_lock);
+    void *new_ptr = untraced_realloc(ptr, size);
+    trace_write(TRACE_REALLOC, new_ptr, ptr, size);
+    pthread_mutex_unlock(&trace_lock);
+    trace_busy = 0;
+#else
+    void *new_ptr = untraced_realloc(ptr, size);
+    trace_record(TRACE_REALLOC, new_ptr, ptr, size);
+#endif
+    return new_ptr;
+}
+
+// Function to allocate zeroed memory and record the call in the trace
+void *HmmCalloc(size_t count, size_t size)
+{
+    void *ptr = untraced_calloc(count, size);
+    trace_record(TRACE_CALLOC, ptr, NULL, ptr ? count * size : 0);
+    return ptr;
+}
+
+// Function to allocate a batch of blocks and record each one in the trace
+size_t HmmAllocBatch(size_t size, size_t count, void **out)
+{
+    size_t allocated = untraced_alloc_batch(size, count, out);
+    for (size_t i = 0; i < allocated; i++)
+    {
+        trace_record(TRACE_ALLOC, out[i], NULL, size);
+    }
+    return allocated;
+}
+
+// Function to allocate aligned memory and record the call in the trace
+void *HmmAllocAligned(size_t size, size_t alignment)
+{
+    void *ptr = untraced_alloc_aligned(size, alignment);
+    trace_record(TRACE_ALLOC, ptr, NULL, size);
+    return ptr;
+}
+
+// Function to free a batch of blocks and record each one in the trace
+void HmmFreeBatch(void **ptrs, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (ptrs[i])
+        {
+            trace_record(TRACE_FREE, ptrs[i], NULL, 0);  // Recorded first, another thread may get the address back right away
+        }
+    }
+    untraced_free_batch(ptrs, count);
+}
+
+// Function to append a record to the trace, skipping the calls stdio makes while a record is written
+static void trace_record(uint8_t op, void *ptr, void *old_ptr, size_t size)
+{
+    if (trace_busy)
+    {
+        return;
+    }
+    trace_busy = 1;
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&trace_lock);
+#endif
+    trace_write(op, ptr, old_ptr, size);
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_unlock(&trace_lock);
+#endif
+    trace_busy = 0;
+}
+
+// Function to encode a record into the trace named by HMM_TRACE_FILE (hmm.trace by default), called with trace_lock held
+static void trace_write(uint8_t op, void *ptr, void *old_ptr, size_t size)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+
+    if (trace_file == NULL)
+    {
+        if (trace_failed)
+        {
+            return;
+        }
+
+        const char *name = getenv("HMM_TRACE_FILE");
+        trace_file = fopen(name ? name : "hmm.trace", "wb");
+        if (trace_file == NULL)
+        {
+            trace_failed = 1;
+            return;
+        }
+        setvbuf(trace_file, NULL, _IONBF, 0);  // trace_buffer already batches the writes
+        fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, trace_file);
+        trace_start = now_ns;
+        atexit(trace_flush);
+    }
+
+    TraceRecord rec = { 0 };
+    rec.op = op;
+#ifdef HMM_THREAD_SAFE
+    if (trace_thread == 0)
+    {
+        trace_thread = atomic_fetch_add(&trace_threads, 1) + 1;
+    }
+    rec.thread = trace_thread;
+#endif
+    rec.time_ns = now_ns - trace_start;
+    rec.ptr = (uintptr_t)ptr;
+    rec.old_ptr = (uintptr_t)old_ptr;
+    rec.size = size;
+
+    if (trace_used + TRACE_MAX_RECORD > TRACE_BUFFER_SIZE)
+    {
+        fwrite(trace_buffer, 1, trace_used, trace_file);
+        trace_used = 0;
+    }
+    trace_used += trace_encode(trace_buffer + trace_used, &rec, &trace_prev);
+}
+
+// Function to write out the records still in the buffer, registered with atexit()
+static void trace_flush(void)
+{
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_lock(&trace_lock);
+#endif
+    if (trace_file)
+    {
+        fwrite(trace_buffer, 1, trace_used, trace_file);
+        fflush(trace_file);
+        trace_used = 0;
+    }
+#ifdef HMM_THREAD_SAFE
+    pthread_mutex_unlock(&trace_lock);
+#endif
+}
+#endif
+
+#endif
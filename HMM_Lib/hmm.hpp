@@ -0,0 +1,246 @@
+/**************** Author  : Mohamed Ayman *****************/
+/**************** Name    : hmm.hpp       *****************/
+/**************** Version : 0.0.1         *****************/
+/**************** Date    : 12-8-2024     *****************/
+
+// C++ adapters of the Heap Memory Manager: std::pmr memory resources and an allocator for the standard containers.
+// The allocator itself is C: compile hmm.h with HMM_IMPLEMENTATION in one .c file, and build this side with C++17
+// and the same configuration macros.
+//
+//     hmm::region_resource request(buffer, sizeof(buffer));           // Everything a request allocates, freed at once
+//     std::pmr::vector<int> ids(&request);
+//     std::unordered_map<int, Node, std::hash<int>, std::equal_to<int>, hmm::allocator<std::pair<const int, Node>>> nodes;
+
+#ifndef HMM_HPP
+#define HMM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+#include "hmm.h"
+
+namespace hmm
+{
+
+// Memory resource on the shared heap: small objects come from the slabs and thread caches, larger ones from the bins
+class heap_resource final : public std::pmr::memory_resource
+{
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void *ptr = HmmAllocAligned(bytes == 0 ? 1 : bytes, alignment);  // Alignments up to HMM_ALIGNMENT take HmmAlloc()
+        if (ptr == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override
+    {
+        if (alignment <= HMM_ALIGNMENT)
+        {
+            HmmFreeSized(ptr, bytes == 0 ? 1 : bytes);  // The size is known, so the header is never read
+        }
+        else
+        {
+            HmmFree(ptr);  // An aligned block may be smaller than the class of its size
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return dynamic_cast<const heap_resource *>(&other) != nullptr;  // Every instance hands out the same heap
+    }
+};
+
+// Function to get the resource of the shared heap, like std::pmr::new_delete_resource()
+inline heap_resource *get_heap_resource() noexcept
+{
+    static heap_resource resource;
+    return &resource;
+}
+
+// Memory resource on an arena in a caller-supplied buffer, whose blocks are freed one by one
+class arena_resource final : public std::pmr::memory_resource
+{
+public:
+    arena_resource(void *buffer, std::size_t size) : arena_(HmmArenaCreate(buffer, size))
+    {
+        if (arena_ == nullptr)
+        {
+            throw std::bad_alloc();  // The buffer cannot hold the arena's state and one block
+        }
+    }
+
+    arena_resource(const arena_resource &) = delete;
+    arena_resource &operator=(const arena_resource &) = delete;
+
+    HmmArena *arena() const noexcept
+    {
+        return arena_;
+    }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void *ptr = HmmArenaAllocAligned(arena_, bytes == 0 ? 1 : bytes, alignment);
+        if (ptr == nullptr)
+        {
+            throw std::bad_alloc();  // The arena is full
+        }
+        return ptr;
+    }
+
+    void do_deallocate(void *ptr, std::size_t, std::size_t) override
+    {
+        HmmArenaFree(arena_, ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    HmmArena *arena_;
+};
+
+// Memory resource on an arena used as a region: deallocation does nothing and release() frees everything at once,
+// which suits the containers of one request
+class region_resource final : public std::pmr::memory_resource
+{
+public:
+    region_resource(void *buffer, std::size_t size) : arena_(HmmArenaCreate(buffer, size))
+    {
+        if (arena_ == nullptr)
+        {
+            throw std::bad_alloc();  // The buffer cannot hold the arena's state
+        }
+    }
+
+    region_resource(const region_resource &) = delete;
+    region_resource &operator=(const region_resource &) = delete;
+
+    ~region_resource() override
+    {
+        release();
+    }
+
+    // Function to free everything allocated from the region; containers using it must be gone by then
+    void release() noexcept
+    {
+        HmmRegionReset(arena_);
+    }
+
+    HmmArena *arena() const noexcept
+    {
+        return arena_;
+    }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        // The region has no block to move, so an over-aligned request takes the padding to the next multiple
+        std::size_t padding = alignment > HMM_ALIGNMENT ? alignment - HMM_ALIGNMENT : 0;
+        void *ptr = bytes < std::numeric_limits<std::size_t>::max() - padding ? HmmRegionAlloc(arena_, (bytes == 0 ? 1 : bytes) + padding) : nullptr;
+        if (ptr == nullptr)
+        {
+            throw std::bad_alloc();  // The region is full
+        }
+        return reinterpret_cast<void *>((reinterpret_cast<std::uintptr_t>(ptr) + alignment - 1) & ~(std::uintptr_t)(alignment - 1));
+    }
+
+    void do_deallocate(void *, std::size_t, std::size_t) override
+    {
+        // Memory of a region only comes back through release()
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    HmmArena *arena_;
+};
+
+// Allocator for the standard containers, on an arena or on the shared heap, where the nodes of node-based containers
+// come from the slab class of their size
+template <class T>
+class allocator
+{
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;  // The memory moves with the container
+    using propagate_on_container_swap = std::true_type;
+
+    allocator() noexcept = default;
+
+    explicit allocator(HmmArena *arena) noexcept : arena_(arena)
+    {
+    }
+
+    template <class U>
+    allocator(const allocator<U> &other) noexcept : arena_(other.arena())
+    {
+    }
+
+    T *allocate(std::size_t count)
+    {
+        if (count > std::numeric_limits<std::size_t>::max() / sizeof(T))
+        {
+            throw std::bad_array_new_length();
+        }
+
+        std::size_t bytes = count == 0 ? 1 : count * sizeof(T);
+        void *ptr = arena_ ? HmmArenaAllocAligned(arena_, bytes, alignof(T)) : HmmAllocAligned(bytes, alignof(T));
+        if (ptr == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, std::size_t count) noexcept
+    {
+        if (arena_)
+        {
+            HmmArenaFree(arena_, ptr);
+        }
+        else if (alignof(T) <= HMM_ALIGNMENT)
+        {
+            HmmFreeSized(ptr, count == 0 ? 1 : count * sizeof(T));  // The size allocate() asked for
+        }
+        else
+        {
+            HmmFree(ptr);
+        }
+    }
+
+    HmmArena *arena() const noexcept
+    {
+        return arena_;
+    }
+
+private:
+    HmmArena *arena_ = nullptr;  // NULL for the shared heap behind HmmAlloc()
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.arena() == b.arena();  // Either can free the other's memory when both use the same heap
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return !(a == b);
+}
+
+}
+
+#endif
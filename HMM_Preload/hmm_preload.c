@@ -0,0 +1,208 @@
+/**************** Author  : Mohamed Ayman *****************/
+/**************** Name    : hmm_preload.c *****************/
+/**************** Version : 0.0.1         *****************/
+/**************** Date    : 12-8-2024     *****************/
+
+// Drop-in replacement of the C allocation functions on top of HmmAlloc() and HmmFree(), to run unmodified programs on HMM.
+// Build it as a shared library and preload it:
+//   gcc -O2 -fPIC -shared -fvisibility=hidden -ftls-model=initial-exec -pthread -o libhmm.so HMM_Preload/hmm_preload.c
+//   LD_PRELOAD=./libhmm.so ./program
+// The allocator's internals are static, and -fvisibility=hidden also hides its Hmm* API, so only the functions
+// marked HMM_EXPORT are visible. -ftls-model=initial-exec keeps thread-local variables from calling malloc().
+// Any other allocator configuration can be added with -D, as for the library itself.
+
+// Real programs are threaded and expect freed memory to go back to the OS
+#ifndef HMM_THREAD_SAFE
+#define HMM_THREAD_SAFE
+#endif
+#ifndef HMM_USE_MMAP
+#define HMM_USE_MMAP
+#endif
+
+#define HMM_IMPLEMENTATION
+#include "../HMM_Lib/hmm.h"
+
+#include <errno.h>
+#include <stdint.h>
+
+#define HMM_EXPORT __attribute__((visibility("default")))  // Exported even though the rest of the library is hidden
+#define MAX_REQUEST ((size_t)PTRDIFF_MAX)  // Larger requests fail like they do with glibc, before ALIGN() could wrap them
+
+// Function prototypes
+HMM_EXPORT void *malloc(size_t size);
+HMM_EXPORT void free(void *ptr);
+HMM_EXPORT void free_sized(void *ptr, size_t size);
+HMM_EXPORT void free_aligned_sized(void *ptr, size_t alignment, size_t size);
+HMM_EXPORT void *calloc(size_t count, size_t size);
+HMM_EXPORT void *realloc(void *ptr, size_t size);
+HMM_EXPORT int posix_memalign(void **out, size_t alignment, size_t size);
+HMM_EXPORT void *aligned_alloc(size_t alignment, size_t size);
+HMM_EXPORT void *memalign(size_t alignment, size_t size);
+HMM_EXPORT void *valloc(size_t size);
+HMM_EXPORT void *pvalloc(size_t size);
+HMM_EXPORT size_t malloc_usable_size(void *ptr);
+void preload_fork_prepare(void);
+void preload_fork_release(void);
+void preload_init(void) __attribute__((constructor));
+
+// Function to allocate memory like malloc(), which returns a unique pointer even for 0 bytes
+void *malloc(size_t size)
+{
+    if (size > MAX_REQUEST)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void *ptr = HmmAlloc(size == 0 ? 1 : size);
+    if (ptr == NULL)
+    {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+// Function to free memory like free()
+void free(void *ptr)
+{
+    HmmFree(ptr);
+}
+
+// Function to free memory of a known size like C23 free_sized()
+void free_sized(void *ptr, size_t size)
+{
+    HmmFreeSized(ptr, size);
+}
+
+// Function to free aligned memory of a known size like C23 free_aligned_sized()
+void free_aligned_sized(void *ptr, size_t alignment, size_t size)
+{
+    (void)alignment;
+    (void)size;
+    HmmFree(ptr);  // An aligned block may be smaller than the class of its size
+}
+
+// Function to allocate zeroed memory like calloc()
+void *calloc(size_t count, size_t size)
+{
+    if (count != 0 && size > MAX_REQUEST / count)
+    {
+        errno = ENOMEM;
+        return NULL;  // The total size would overflow
+    }
+
+    void *ptr = count == 0 || size == 0 ? HmmCalloc(1, 1) : HmmCalloc(count, size);
+    if (ptr == NULL)
+    {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+// Function to resize memory like realloc(), which frees the block when asked for 0 bytes
+void *realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return malloc(size);
+    }
+    if (size > MAX_REQUEST)
+    {
+        errno = ENOMEM;
+        return NULL;  // The original block is left untouched
+    }
+
+    void *new_ptr = HmmRealloc(ptr, size);
+    if (new_ptr == NULL && size != 0)
+    {
+        errno = ENOMEM;
+    }
+    return new_ptr;
+}
+
+// Function to allocate aligned memory like posix_memalign(), returning an error number instead of setting errno
+int posix_memalign(void **out, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+    {
+        return EINVAL;  // Not a power of two multiple of the pointer size
+    }
+    if (size > MAX_REQUEST)
+    {
+        return ENOMEM;
+    }
+
+    void *ptr = HmmAllocAligned(size == 0 ? 1 : size, alignment);
+    if (ptr == NULL)
+    {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+// Function to allocate aligned memory like aligned_alloc()
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+// Function to allocate aligned memory like memalign(), which also accepts alignments below the pointer size
+void *memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void *ptr = NULL;
+    int error = posix_memalign(&ptr, alignment < sizeof(void *) ? sizeof(void *) : alignment, size);
+    if (error != 0)
+    {
+        errno = error;
+    }
+    return ptr;
+}
+
+// Function to allocate page-aligned memory like valloc()
+void *valloc(size_t size)
+{
+    return memalign((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+// Function to allocate whole pages like pvalloc()
+void *pvalloc(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > MAX_REQUEST - page)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+// Function to get the usable size of an allocation like malloc_usable_size()
+size_t malloc_usable_size(void *ptr)
+{
+    return HmmUsableSize(ptr);
+}
+
+// Function to take the heap lock before fork(), so the child never inherits it held by a thread it does not have
+void preload_fork_prepare(void)
+{
+    pthread_mutex_lock(&heap_lock);
+}
+
+// Function to release the heap lock after fork(), in both the parent and the child
+void preload_fork_release(void)
+{
+    unlock_heap();
+}
+
+// Function to register the fork handlers when the library is loaded
+void preload_init(void)
+{
+    pthread_atfork(preload_fork_prepare, preload_fork_release, preload_fork_release);
+}
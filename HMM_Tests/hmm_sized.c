@@ -0,0 +1,130 @@
+/**************** Author  : Mohamed Ayman *****************/
+/**************** Name    : hmm_sized.c   *****************/
+/**************** Version : 0.0.1         *****************/
+/**************** Date    : 12-8-2024     *****************/
+
+// Checks that a block freed with HmmFreeSized() is as large as the size class it lands in,
+// so the next HmmAlloc() of that class cannot get a block too small for it,
+// and that a block shrunk by HmmRealloc() keeps small objects aligned.
+// Aligned blocks are the case to watch: hmm.hpp frees them through HmmFreeSized() too.
+//   gcc -O2 -DHMM_CACHE_ALIGNED -DHMM_THREAD_SAFE -pthread -IHMM_Lib -o hmm_sized HMM_Tests/hmm_sized.c
+//   ./hmm_sized
+// Prints the first mismatches and exits with 1 on failure.
+
+#define HMM_IMPLEMENTATION
+#include "hmm.h"
+
+#include <stdio.h>
+
+// Largest size checked; covers every thread cache class
+#define MAX_SIZE 512
+
+// Number of mismatches printed before the rest are only counted
+#define MAX_REPORTS 8
+
+static int failures = 0;
+
+// Function to get the alignment HmmAlloc() promises for a request of size bytes
+static size_t alloc_alignment(size_t size)
+{
+#if defined(HMM_CACHE_ALIGNED) && defined(HMM_HARDENED)
+    if (size <= SLAB_MAX_OBJECT - GUARD_SIZE)
+    {
+        return CACHE_LINE_SIZE;  // The tail canary counts towards the size of the object
+    }
+#elif defined(HMM_CACHE_ALIGNED)
+    if (size <= SLAB_MAX_OBJECT)
+    {
+        return CACHE_LINE_SIZE;  // Small objects start on a cache line of their own
+    }
+#endif
+    (void)size;
+    return HMM_ALIGNMENT;
+}
+
+// Counts a failure if ptr is not a multiple of alignment
+static void check_alignment(void *ptr, size_t alignment, const char *what, size_t size)
+{
+    if (((uintptr_t)ptr & (alignment - 1)) != 0)
+    {
+        if (failures++ < MAX_REPORTS)
+        {
+            printf("%s(%zu): %p is not %zu-byte aligned\n", what, size, ptr, alignment);
+        }
+    }
+}
+
+// Frees ptr as a block of size bytes, then checks the block a same-class allocation gets back
+static void check_class(void *ptr, size_t size, const char *what, size_t alignment)
+{
+    size_t usable = HmmUsableSize(ptr);
+
+    check_alignment(ptr, alignment ? alignment : alloc_alignment(size), what, size);
+
+    if (usable < size)
+    {
+        if (failures++ < MAX_REPORTS)
+        {
+            printf("%s(%zu, %zu): usable size %zu\n", what, size, alignment, usable);
+        }
+    }
+
+    HmmFreeSized(ptr, size);
+
+    // Ask for every size from the next cache line, the largest size in the same class, down to size
+    for (size_t request = (size + 63) & ~(size_t)63; request >= size; request--)
+    {
+        void *block = HmmAlloc(request);
+
+        check_alignment(block, alloc_alignment(request), "HmmAlloc", request);
+        if (block == NULL || HmmUsableSize(block) < request)
+        {
+            if (failures++ < MAX_REPORTS)
+            {
+                printf("HmmAlloc(%zu) after %s(%zu, %zu): usable size %zu\n",
+                       request, what, size, alignment, block ? HmmUsableSize(block) : 0);
+            }
+        }
+
+        HmmFree(block);
+    }
+}
+
+// Shrinks a heap block to a small size and checks that neither it nor the small blocks allocated after it was freed
+// lose the alignment of small objects, which a shrunk block did under HMM_CACHE_ALIGNED when it stayed where it was
+static void check_shrunk_block(void)
+{
+    void *big = HmmAlloc(4096);
+    void *next = HmmAlloc(4096);  // Keeps the shrunk block from merging with the rest of the heap
+
+    void *small = HmmRealloc(big, 100);
+    check_alignment(small, alloc_alignment(100), "HmmRealloc", 100);
+    HmmFreeSized(small, 100);
+
+    void *aligned = HmmAllocAligned(100, 64);
+    check_alignment(aligned, 64, "HmmAllocAligned", 100);
+    void *block = HmmAlloc(128);
+    check_alignment(block, alloc_alignment(128), "HmmAlloc", 128);
+
+    HmmFree(block);
+    HmmFree(aligned);
+    HmmFree(next);
+}
+
+int main(void)
+{
+    check_shrunk_block();
+
+    for (size_t size = 1; size <= MAX_SIZE; size++)
+    {
+        check_class(HmmAlloc(size), size, "HmmAlloc", 0);
+
+        for (size_t alignment = 16; alignment <= 4096; alignment *= 2)
+        {
+            check_class(HmmAllocAligned(size, alignment), size, "HmmAllocAligned", alignment);
+        }
+    }
+
+    printf("%s: %d failure(s)\n", failures ? "FAIL" : "ok", failures);
+    return failures ? 1 : 0;
+}
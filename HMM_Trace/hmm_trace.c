@@ -0,0 +1,405 @@
+/**************** Author  : Mohamed Ayman *****************/
+/**************** Name    : hmm_trace.c   *****************/
+/**************** Version : 0.0.1         *****************/
+/**************** Date    : 12-8-2024     *****************/
+
+// Offline tool for allocation traces recorded by an allocator built with -DHMM_TRACE.
+//   hmm_trace dump <trace>      prints every record
+//   hmm_trace replay <trace>    replays the calls in recorded order and reports latency and memory use
+// Build it against the allocator to measure, like the benchmarks:
+//   gcc -O2 -DHMM_NO_DEMO -DTRACE_LABEL='"reduced"' -o trace_reduced HMM_Trace/hmm_trace.c HMM_Reduced/hmm_reduced.c
+//   gcc -O2 -DTRACE_SYSTEM_MALLOC -DTRACE_LABEL='"malloc"' -o trace_malloc HMM_Trace/hmm_trace.c
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "hmm_trace.h"
+
+#ifndef TRACE_LABEL
+#define TRACE_LABEL "hmm"
+#endif
+
+#ifdef TRACE_SYSTEM_MALLOC
+// Baseline: replay against the C library allocator
+#define HmmAlloc malloc
+#define HmmFree free
+#define HmmRealloc realloc
+#define HmmCalloc calloc
+#else
+// Declare external functions for the custom Heap Memory Manager
+extern void *HmmAlloc(size_t size);                 // Function to allocate memory
+extern void HmmFree(void *ptr);                     // Function to free allocated memory
+extern void *HmmRealloc(void *ptr, size_t size);    // Function to resize allocated memory
+extern void *HmmCalloc(size_t count, size_t size);  // Function to allocate zeroed memory
+#endif
+
+// A recorded pointer that is live in the replay
+typedef struct LiveEntry
+{
+    uint64_t recorded;          // Address in the traced process, 0 for an empty slot
+    void *ptr;                  // Address of the replayed allocation
+    size_t size;                // Requested size
+} LiveEntry;
+
+// Open-addressing table from recorded to replayed addresses
+typedef struct LiveTable
+{
+    LiveEntry *entries;
+    size_t capacity;            // Always a power of two
+    size_t count;
+} LiveTable;
+
+// Function prototypes
+int load_trace(const char *path, TraceRecord **records, size_t *count);
+int dump_trace(const TraceRecord *records, size_t count);
+int replay_trace(const TraceRecord *records, size_t count);
+LiveEntry *live_find(LiveTable *table, uint64_t recorded);
+int live_insert(LiveTable *table, uint64_t recorded, void *ptr, size_t size);
+int live_grow(LiveTable *table);
+void live_remove(LiveTable *table, LiveEntry *entry);
+uint64_t now_ns(void);
+uint32_t elapsed_ns(uint64_t start);
+long current_rss_kb(void);
+int compare_samples(const void *a, const void *b);
+
+int main(int argc, char **argv)
+{
+    if (argc != 3 || (strcmp(argv[1], "dump") != 0 && strcmp(argv[1], "replay") != 0))
+    {
+        fprintf(stderr, "usage: %s dump|replay <trace>\n", argv[0]);
+        return 2;
+    }
+
+    TraceRecord *records;
+    size_t count;
+    if (!load_trace(argv[2], &records, &count))
+    {
+        return 1;
+    }
+    return strcmp(argv[1], "dump") == 0 ? dump_trace(records, count) : replay_trace(records, count);
+}
+
+// Function to read a whole trace into memory, so the replay does no file I/O while it is timed
+int load_trace(const char *path, TraceRecord **records, size_t *count)
+{
+    FILE *in = fopen(path, "rb");
+    if (in == NULL)
+    {
+        perror(path);
+        return 0;
+    }
+
+    char magic[TRACE_MAGIC_SIZE];
+    if (fread(magic, 1, TRACE_MAGIC_SIZE, in) != TRACE_MAGIC_SIZE || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "%s: not an allocation trace\n", path);
+        fclose(in);
+        return 0;
+    }
+
+    size_t capacity = 1024;
+    TraceRecord prev = { 0 };
+    *records = malloc(capacity * sizeof(TraceRecord));
+    *count = 0;
+    while (*records && trace_decode(in, &(*records)[*count], &prev))
+    {
+        if (++*count == capacity)
+        {
+            capacity *= 2;
+            TraceRecord *grown = realloc(*records, capacity * sizeof(TraceRecord));
+            if (grown == NULL)
+            {
+                free(*records);  // realloc() leaves the old buffer allocated when it fails
+            }
+            *records = grown;
+        }
+    }
+    fclose(in);
+
+    if (*records == NULL)
+    {
+        fprintf(stderr, "%s: out of memory\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+// Function to print the records of a trace one per line
+int dump_trace(const TraceRecord *records, size_t count)
+{
+    static const char *names[] = { "?", "alloc", "free", "realloc", "calloc" };
+    for (size_t i = 0; i < count; i++)
+    {
+        const TraceRecord *rec = &records[i];
+        printf("%12.6f t%-3u %-7s", rec->time_ns / 1e9, rec->thread, names[rec->op]);
+        if (rec->op == TRACE_REALLOC)
+        {
+            printf(" %#llx ->", (unsigned long long)rec->old_ptr);
+        }
+        printf(" %#llx", (unsigned long long)rec->ptr);
+        if (rec->op != TRACE_FREE)
+        {
+            printf(" %llu", (unsigned long long)rec->size);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+// Function to replay a trace against HmmAlloc/HmmFree and report latency percentiles and memory use
+int replay_trace(const TraceRecord *records, size_t count)
+{
+    // Size the table for the busiest point of the trace up front, so it does not grow while timed;
+    // frees of blocks allocated before the trace started are not counted, live_insert() grows it if it is still short
+    LiveTable table = { NULL, 1024, 0 };
+    long live = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        live += records[i].op == TRACE_FREE ? -1 : records[i].op == TRACE_REALLOC ? 0 : 1;
+        if (live < 0)
+        {
+            live = 0;
+        }
+        while ((long)table.capacity < live * 2)
+        {
+            table.capacity *= 2;
+        }
+    }
+    table.entries = calloc(table.capacity, sizeof(LiveEntry));
+    uint32_t *samples = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (table.entries == NULL || samples == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memset(samples, 0xFF, count * sizeof(uint32_t));  // Touch the buffer so it counts in the baseline
+
+    size_t taken = 0, live_bytes = 0, peak_live = 0, unknown = 0, failed = 0;
+    long baseline_kb = current_rss_kb();
+    uint64_t replay_start = now_ns();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const TraceRecord *rec = &records[i];
+        LiveEntry *entry = NULL;
+        void *result = NULL;
+        uint64_t start;
+
+        if (rec->op != TRACE_FREE && rec->ptr == 0 && rec->size)
+        {
+            continue;  // The call failed in the traced process, so nothing later refers to it
+        }
+
+        if (rec->op == TRACE_FREE || rec->op == TRACE_REALLOC)
+        {
+            uint64_t recorded = rec->op == TRACE_FREE ? rec->ptr : rec->old_ptr;
+            entry = recorded ? live_find(&table, recorded) : NULL;
+            if (recorded && entry == NULL)
+            {
+                unknown++;  // Allocated before the trace started, or its allocation failed in the replay
+                continue;
+            }
+        }
+
+        switch (rec->op)
+        {
+        case TRACE_ALLOC:
+            start = now_ns();
+            result = HmmAlloc(rec->size);
+            samples[taken++] = elapsed_ns(start);
+            break;
+        case TRACE_CALLOC:
+            start = now_ns();
+            result = HmmCalloc(1, rec->size);
+            samples[taken++] = elapsed_ns(start);
+            break;
+        case TRACE_FREE:
+            start = now_ns();
+            HmmFree(entry->ptr);
+            samples[taken++] = elapsed_ns(start);
+            live_bytes -= entry->size;
+            live_remove(&table, entry);
+            continue;
+        case TRACE_REALLOC:
+            start = now_ns();
+            result = HmmRealloc(entry ? entry->ptr : NULL, rec->size);
+            samples[taken++] = elapsed_ns(start);
+            if (entry && (result || rec->size == 0))
+            {
+                live_bytes -= entry->size;  // The old block is gone, or was freed by a size of 0
+                live_remove(&table, entry);
+            }
+            break;
+        }
+
+        if (result)
+        {
+            memset(result, 0x5A, rec->size);  // Touch the memory like the traced program did
+            live_bytes += rec->size;
+            if (!live_insert(&table, rec->ptr, result, rec->size))
+            {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+        }
+        else if (rec->size)
+        {
+            failed++;
+        }
+        if (live_bytes > peak_live)
+        {
+            peak_live = live_bytes;
+        }
+    }
+
+    uint64_t elapsed = now_ns() - replay_start;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peak_kb = usage.ru_maxrss - baseline_kb;  // Memory the allocator needed on top of the tool
+
+    qsort(samples, taken, sizeof(uint32_t), compare_samples);
+    size_t n = taken ? taken : 1;
+    double peak_live_kb = peak_live / 1024.0;
+
+    printf("%-8s %10s %12s %8s %8s %8s %8s %10s %11s %11s %7s %8s %8s\n",
+           "alloc", "ops", "ops/sec", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns",
+           "peak KB", "live KB", "frag", "failed", "unknown");
+    printf("%-8s %10zu %12.0f %8u %8u %8u %8u %10u %11ld %11.0f %7.2f %8zu %8zu\n",
+           TRACE_LABEL, taken, taken / (elapsed / 1e9),
+           samples[n * 50 / 100], samples[n * 90 / 100], samples[n * 99 / 100], samples[n * 999 / 1000], samples[n - 1],
+           peak_kb, peak_live_kb, peak_live_kb > 0 ? peak_kb / peak_live_kb : 0.0, failed, unknown);
+    return 0;
+}
+
+// Function to find the live entry of a recorded address, or NULL if it is not live
+LiveEntry *live_find(LiveTable *table, uint64_t recorded)
+{
+    size_t mask = table->capacity - 1;
+    for (size_t i = (recorded >> 4) * 0x9E3779B97F4A7C15ULL & mask; table->entries[i].recorded; i = (i + 1) & mask)
+    {
+        if (table->entries[i].recorded == recorded)
+        {
+            return &table->entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Function to add a recorded address, replacing an entry still there for it; returns 0 if the table is full
+// and cannot grow, since lookups rely on an empty slot to end every probe run
+int live_insert(LiveTable *table, uint64_t recorded, void *ptr, size_t size)
+{
+    if ((table->count + 1) * 2 > table->capacity && !live_grow(table) && table->count + 1 >= table->capacity)
+    {
+        return 0;
+    }
+
+    size_t mask = table->capacity - 1;
+    size_t i = (recorded >> 4) * 0x9E3779B97F4A7C15ULL & mask;
+    while (table->entries[i].recorded && table->entries[i].recorded != recorded)
+    {
+        i = (i + 1) & mask;
+    }
+    if (table->entries[i].recorded == 0)
+    {
+        table->count++;
+    }
+    table->entries[i].recorded = recorded;
+    table->entries[i].ptr = ptr;
+    table->entries[i].size = size;
+    return 1;
+}
+
+// Function to double the capacity of the table, moving every entry to its slot in the larger one; returns 0 on failure
+int live_grow(LiveTable *table)
+{
+    LiveTable grown = { calloc(table->capacity * 2, sizeof(LiveEntry)), table->capacity * 2, 0 };
+    if (grown.entries == NULL)
+    {
+        return 0;
+    }
+
+    size_t mask = grown.capacity - 1;
+    for (size_t j = 0; j < table->capacity; j++)
+    {
+        if (table->entries[j].recorded)
+        {
+            size_t i = (table->entries[j].recorded >> 4) * 0x9E3779B97F4A7C15ULL & mask;
+            while (grown.entries[i].recorded)
+            {
+                i = (i + 1) & mask;
+            }
+            grown.entries[i] = table->entries[j];
+            grown.count++;
+        }
+    }
+    free(table->entries);
+    *table = grown;
+    return 1;
+}
+
+// Function to remove an entry, moving back later entries of its probe run so lookups need no tombstones
+void live_remove(LiveTable *table, LiveEntry *entry)
+{
+    size_t mask = table->capacity - 1;
+    size_t hole = (size_t)(entry - table->entries);
+    table->entries[hole].recorded = 0;
+    table->count--;
+
+    for (size_t i = (hole + 1) & mask; table->entries[i].recorded; i = (i + 1) & mask)
+    {
+        size_t home = (table->entries[i].recorded >> 4) * 0x9E3779B97F4A7C15ULL & mask;
+        // The entry may fill the hole only if the hole lies on its probe path from home to i
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            table->entries[hole] = table->entries[i];
+            table->entries[i].recorded = 0;
+            hole = i;
+        }
+    }
+}
+
+// Function to read a monotonic clock in nanoseconds
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Function to get the nanoseconds since start as a sample, clamped so a call slower than 4.29 s does not wrap
+uint32_t elapsed_ns(uint64_t start)
+{
+    uint64_t ns = now_ns() - start;
+    return ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+}
+
+// Function to read the resident set size of the process in KB
+long current_rss_kb(void)
+{
+    long size, pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm)
+    {
+        if (fscanf(statm, "%ld %ld", &size, &pages) != 2)
+        {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Function to order latency samples for the percentiles
+int compare_samples(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,130 @@
+/**************** Author  : Mohamed Ayman *****************/
+/**************** Name    : hmm_trace.h   *****************/
+/**************** Version : 0.0.1         *****************/
+/**************** Date    : 12-8-2024     *****************/
+
+// Binary allocation trace format, shared by the recorder in the allocators (HMM_TRACE) and the hmm_trace tool.
+// A trace is TRACE_MAGIC followed by records of one op byte and LEB128 varints:
+//   thread, time delta in ns, pointer (zigzag delta from the previous pointer), then per op:
+//   TRACE_ALLOC/TRACE_CALLOC: size        TRACE_FREE: nothing        TRACE_REALLOC: old pointer (zigzag delta), size
+
+#ifndef HMM_TRACE_H
+#define HMM_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TRACE_MAGIC "HMMTRC1\n"
+#define TRACE_MAGIC_SIZE 8
+#define TRACE_MAX_RECORD 64  // Upper bound of one encoded record
+
+// Operations in a trace
+#define TRACE_ALLOC 1
+#define TRACE_FREE 2
+#define TRACE_REALLOC 3
+#define TRACE_CALLOC 4
+
+// One decoded trace record
+typedef struct TraceRecord
+{
+    uint8_t op;                 // TRACE_ALLOC, TRACE_FREE, TRACE_REALLOC or TRACE_CALLOC
+    uint32_t thread;            // Small id of the thread that made the call
+    uint64_t time_ns;           // Time since the trace started
+    uint64_t ptr;               // Returned pointer, or the freed one; 0 when an allocation failed
+    uint64_t old_ptr;           // Pointer passed to realloc
+    uint64_t size;              // Requested size; count * size for calloc
+} TraceRecord;
+
+// Function to append a LEB128 varint to a buffer, returning the bytes written
+static inline size_t trace_put_varint(uint8_t *out, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+// Function to read a LEB128 varint, returning 0 at the end of the file
+static inline int trace_get_varint(FILE *in, uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = getc(in);
+        if (byte == EOF)
+        {
+            return 0;
+        }
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            return 1;
+        }
+    }
+    return 0;  // Corrupt: too many continuation bytes
+}
+
+// Function to encode a record relative to the previous one, returning its length
+static inline size_t trace_encode(uint8_t *out, const TraceRecord *rec, TraceRecord *prev)
+{
+    int64_t ptr_delta = (int64_t)(rec->ptr - prev->ptr);
+    size_t n = 0;
+    out[n++] = rec->op;
+    n += trace_put_varint(out + n, rec->thread);
+    n += trace_put_varint(out + n, rec->time_ns - prev->time_ns);
+    n += trace_put_varint(out + n, ((uint64_t)ptr_delta << 1) ^ (uint64_t)(ptr_delta >> 63));  // Zigzag keeps small negative deltas short
+    if (rec->op == TRACE_REALLOC)
+    {
+        int64_t old_delta = (int64_t)(rec->old_ptr - rec->ptr);
+        n += trace_put_varint(out + n, ((uint64_t)old_delta << 1) ^ (uint64_t)(old_delta >> 63));
+    }
+    if (rec->op != TRACE_FREE)
+    {
+        n += trace_put_varint(out + n, rec->size);
+    }
+    *prev = *rec;
+    return n;
+}
+
+// Function to decode the next record, returning 1 on success and 0 at the end of the trace
+static inline int trace_decode(FILE *in, TraceRecord *rec, TraceRecord *prev)
+{
+    uint64_t thread, time_delta, ptr_zigzag, old_zigzag = 0, size = 0;
+    int op = getc(in);
+    if (op == EOF || op < TRACE_ALLOC || op > TRACE_CALLOC)
+    {
+        return 0;
+    }
+    if (!trace_get_varint(in, &thread) || !trace_get_varint(in, &time_delta) || !trace_get_varint(in, &ptr_zigzag))
+    {
+        return 0;
+    }
+    if (op == TRACE_REALLOC && !trace_get_varint(in, &old_zigzag))
+    {
+        return 0;
+    }
+    if (op != TRACE_FREE && !trace_get_varint(in, &size))
+    {
+        return 0;
+    }
+
+    memset(rec, 0, sizeof(*rec));
+    rec->op = (uint8_t)op;
+    rec->thread = (uint32_t)thread;
+    rec->time_ns = prev->time_ns + time_delta;
+    rec->ptr = prev->ptr + (uint64_t)((int64_t)(ptr_zigzag >> 1) ^ -(int64_t)(ptr_zigzag & 1));
+    if (op == TRACE_REALLOC)
+    {
+        rec->old_ptr = rec->ptr + (uint64_t)((int64_t)(old_zigzag >> 1) ^ -(int64_t)(old_zigzag & 1));
+    }
+    rec->size = size;
+    *prev = *rec;
+    return 1;
+}
+
+#endif